@@ -1,24 +1,387 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "async.h"
+#include "timer.h"
 
 tpool_pool *pool = NULL;
 pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 void async_init(size_t num_threads) {
+    async_init_config(&(async_config) {.size = num_threads});
+}
+
+void async_init_config(const async_config *config) {
     pthread_mutex_lock(&pool_mutex);
     if (pool == NULL) {
-        pool = tpool_init(num_threads);
+        pool = tpool_init_config(config);
     }
     pthread_mutex_unlock(&pool_mutex);
 }
 
+async_executor *async_executor_create(const async_config *config) {
+    return tpool_init_config(config);
+}
+
+void async_executor_close(async_executor *exec) {
+    tpool_close(exec);
+}
+
+async_executor *async_default_executor(void) {
+    return pool;
+}
+
+async_executor *async_current_executor(void) {
+    return tpool_current_pool();
+}
+
+// tasks spawned without an executor stay on the one they are spawned from
+static tpool_pool *target(async_executor *exec) {
+    if (exec != NULL) {
+        return exec;
+    }
+    tpool_pool *current = tpool_current_pool();
+    return current != NULL ? current : pool;
+}
+
 async_handle *async_run(async_work fn, void *arg) {
-    return (async_handle *) tpool_task_enqueue(pool, fn, arg);
+    return async_run_attr(fn, arg, (async_attr) {0});
+}
+
+async_handle *async_run_prio(async_work fn, void *arg, async_priority prio) {
+    return async_run_attr(fn, arg, (async_attr) {.prio = prio});
+}
+
+async_handle *async_run_on(async_executor *exec, async_work fn, void *arg) {
+    return async_run_attr(fn, arg, (async_attr) {.exec = exec});
+}
+
+async_handle *async_run_attr(async_work fn, void *arg, async_attr attr) {
+    tpool_task_attr task_attr = {.prio = attr.prio, .stack = attr.stack};
+    if (attr.size > 0) {
+        return (async_handle *) tpool_task_enqueue_copy_attr(target(attr.exec), fn, arg, attr.size, task_attr);
+    }
+    return (async_handle *) tpool_task_enqueue_attr(target(attr.exec), fn, arg, task_attr);
+}
+
+void async_spawn_detached(async_work fn, void *arg) {
+    async_spawn_detached_attr(fn, arg, (async_attr) {0});
+}
+
+void async_spawn_detached_attr(async_work fn, void *arg, async_attr attr) {
+    tpool_task_attr task_attr = {.prio = attr.prio, .stack = attr.stack};
+    if (attr.size > 0) {
+        tpool_task_spawn_detached_copy(target(attr.exec), fn, arg, attr.size, task_attr);
+    } else {
+        tpool_task_spawn_detached_attr(target(attr.exec), fn, arg, task_attr);
+    }
+}
+
+void async_run_batch(async_work fn, void **args, size_t n, async_handle **handles) {
+    tpool_task_enqueue_batch(target(NULL), fn, args, n, (tpool_handle **) handles);
+}
+
+void async_parallel_for(size_t begin, size_t end, size_t grain, async_range_body body, void *arg) {
+    tpool_parallel_for(target(NULL), begin, end, grain, body, arg);
 }
 
 void *async_await(async_handle *handle) {
     return tpool_task_await((tpool_handle *) handle);
 }
 
+void *async_await_into(async_handle *handle, void *result, size_t size) {
+    return tpool_task_await_into((tpool_handle *) handle, result, size);
+}
+
+void async_await_all(async_handle **handles, size_t n, void **results) {
+    tpool_task_await_all((tpool_handle **) handles, n, results);
+}
+
+void async_await_all_into(async_handle **handles, size_t n, void *results, size_t size) {
+    tpool_task_await_all_into((tpool_handle **) handles, n, results, size);
+}
+
+void *async_await_any(async_handle **handles, size_t n, size_t *index) {
+    return tpool_task_await_any((tpool_handle **) handles, n, index);
+}
+
+void *async_await_any_into(async_handle **handles, size_t n, size_t *index, void *result, size_t size) {
+    return tpool_task_await_any_into((tpool_handle **) handles, n, index, result, size);
+}
+
+uint64_t async_now(void) {
+    return tpool_timer_now();
+}
+
+uint64_t async_deadline(uint64_t ns) {
+    return tpool_timer_now() + ns;
+}
+
+void async_sleep(uint64_t ns) {
+    tpool_sleep_until(async_deadline(ns));
+}
+
+void async_sleep_until(uint64_t deadline) {
+    tpool_sleep_until(deadline);
+}
+
+void *async_blocking(async_work work, void *arg) {
+    return tpool_blocking(work, arg);
+}
+
+bool async_await_timeout(async_handle *handle, uint64_t ns, void **result) {
+    return tpool_task_await_until((tpool_handle *) handle, async_deadline(ns), result);
+}
+
+bool async_await_until(async_handle *handle, uint64_t deadline, void **result) {
+    return tpool_task_await_until((tpool_handle *) handle, deadline, result);
+}
+
+bool async_await_timeout_into(async_handle *handle, uint64_t ns, void *result, size_t size) {
+    return tpool_task_await_until_into((tpool_handle *) handle, async_deadline(ns), result, size);
+}
+
+bool async_await_until_into(async_handle *handle, uint64_t deadline, void *result, size_t size) {
+    return tpool_task_await_until_into((tpool_handle *) handle, deadline, result, size);
+}
+
+static bool would_block(void) {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+ssize_t async_read(int fd, void *buf, size_t count) {
+    ssize_t ret;
+    while ((ret = read(fd, buf, count)) < 0 && (errno == EINTR || would_block())) {
+        if (errno != EINTR && tpool_wait_fd(fd, false)) {
+            return -1;
+        }
+    }
+    return ret;
+}
+
+ssize_t async_write(int fd, const void *buf, size_t count) {
+    ssize_t ret;
+    while ((ret = write(fd, buf, count)) < 0 && (errno == EINTR || would_block())) {
+        if (errno != EINTR && tpool_wait_fd(fd, true)) {
+            return -1;
+        }
+    }
+    return ret;
+}
+
+static int accept_nonblock(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+#ifdef __linux__
+    return accept4(fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int conn = accept(fd, addr, addrlen);
+    if (conn >= 0) {
+        fcntl(conn, F_SETFL, fcntl(conn, F_GETFL) | O_NONBLOCK);
+    }
+    return conn;
+#endif
+}
+
+int async_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+    int ret;
+    while ((ret = accept_nonblock(fd, addr, addrlen)) < 0 && (errno == EINTR || would_block())) {
+        if (errno != EINTR && tpool_wait_fd(fd, false)) {
+            return -1;
+        }
+    }
+    return ret;
+}
+
+int async_connect(int fd, const struct sockaddr *addr, socklen_t addrlen) {
+    if (connect(fd, addr, addrlen) == 0) {
+        return 0;
+    }
+    if (errno != EINPROGRESS && errno != EINTR) {
+        return -1;
+    }
+    if (tpool_wait_fd(fd, true)) {
+        return -1;
+    }
+    int error;
+    socklen_t len = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len)) {
+        return -1;
+    }
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+async_channel *async_channel_init(size_t capacity) {
+    return tpool_channel_init(capacity);
+}
+
+void async_channel_free(async_channel *channel) {
+    tpool_channel_free(channel);
+}
+
+int async_channel_send(async_channel *channel, void *item) {
+    return tpool_channel_send(channel, item);
+}
+
+int async_channel_try_send(async_channel *channel, void *item) {
+    return tpool_channel_try_send(channel, item);
+}
+
+int async_channel_recv(async_channel *channel, void **item) {
+    return tpool_channel_recv(channel, item);
+}
+
+int async_channel_try_recv(async_channel *channel, void **item) {
+    return tpool_channel_try_recv(channel, item);
+}
+
+size_t async_channel_recv_many(async_channel *channel, void **items, size_t max) {
+    return tpool_channel_recv_many(channel, items, max);
+}
+
+size_t async_channel_try_recv_many(async_channel *channel, void **items, size_t max) {
+    return tpool_channel_try_recv_many(channel, items, max);
+}
+
+void async_channel_close(async_channel *channel) {
+    tpool_channel_close(channel);
+}
+
+async_mutex *async_mutex_init(void) {
+    return tpool_mutex_init();
+}
+
+void async_mutex_free(async_mutex *mutex) {
+    tpool_mutex_free(mutex);
+}
+
+void async_mutex_lock(async_mutex *mutex) {
+    tpool_mutex_lock(mutex);
+}
+
+bool async_mutex_try_lock(async_mutex *mutex) {
+    return tpool_mutex_try_lock(mutex);
+}
+
+void async_mutex_unlock(async_mutex *mutex) {
+    tpool_mutex_unlock(mutex);
+}
+
+async_sem *async_sem_init(size_t count) {
+    return tpool_sem_init(count);
+}
+
+void async_sem_free(async_sem *sem) {
+    tpool_sem_free(sem);
+}
+
+void async_sem_wait(async_sem *sem) {
+    tpool_sem_wait(sem);
+}
+
+bool async_sem_try_wait(async_sem *sem) {
+    return tpool_sem_try_wait(sem);
+}
+
+void async_sem_post(async_sem *sem) {
+    tpool_sem_post(sem);
+}
+
+async_cond *async_cond_init(void) {
+    return tpool_cond_init();
+}
+
+void async_cond_free(async_cond *cond) {
+    tpool_cond_free(cond);
+}
+
+void async_cond_wait(async_cond *cond, async_mutex *mutex) {
+    tpool_cond_wait(cond, mutex);
+}
+
+void async_cond_signal(async_cond *cond) {
+    tpool_cond_signal(cond);
+}
+
+void async_cond_broadcast(async_cond *cond) {
+    tpool_cond_broadcast(cond);
+}
+
+void async_stats_snapshot(async_stats *stats) {
+    async_stats_snapshot_on(NULL, stats);
+}
+
+void async_stats_snapshot_on(async_executor *exec, async_stats *stats) {
+    tpool_pool *target_pool = target(exec);
+    if (target_pool == NULL) {
+        *stats = (async_stats) {0};
+        return;
+    }
+    tpool_stats_snapshot(target_pool, stats);
+}
+
+size_t async_get_worker_stats(async_worker_stats *stats, size_t max) {
+    return async_get_worker_stats_on(NULL, stats, max);
+}
+
+size_t async_get_worker_stats_on(async_executor *exec, async_worker_stats *stats, size_t max) {
+    tpool_pool *target_pool = target(exec);
+    return target_pool != NULL ? tpool_get_worker_stats(target_pool, stats, max) : 0;
+}
+
+int async_trace_dump(const char *path) {
+    return async_trace_dump_on(NULL, path);
+}
+
+int async_trace_dump_on(async_executor *exec, const char *path) {
+    tpool_pool *target_pool = target(exec);
+    if (target_pool == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    return tpool_trace_dump(target_pool, path);
+}
+
+void async_get_lane_stats(async_lane_stats stats[ASYNC_PRIO_LEVELS]) {
+    async_get_lane_stats_on(NULL, stats);
+}
+
+void async_get_lane_stats_on(async_executor *exec, async_lane_stats stats[ASYNC_PRIO_LEVELS]) {
+    tpool_pool *target_pool = target(exec);
+    if (target_pool == NULL) {
+        memset(stats, 0, sizeof(async_lane_stats) * ASYNC_PRIO_LEVELS);
+        return;
+    }
+    tpool_get_lane_stats(target_pool, stats);
+}
+
+void async_get_stack_stats(async_stack_stats *stats) {
+    async_get_stack_stats_on(NULL, stats);
+}
+
+void async_get_stack_stats_on(async_executor *exec, async_stack_stats *stats) {
+    tpool_pool *target_pool = target(exec);
+    if (target_pool == NULL) {
+        *stats = (async_stack_stats) {0};
+        return;
+    }
+    tpool_get_stack_stats(target_pool, stats);
+}
+
+size_t async_get_stack_profile(async_stack_usage *usage, size_t max) {
+    return async_get_stack_profile_on(NULL, usage, max);
+}
+
+size_t async_get_stack_profile_on(async_executor *exec, async_stack_usage *usage, size_t max) {
+    tpool_pool *target_pool = target(exec);
+    return target_pool != NULL ? tpool_get_stack_profile(target_pool, usage, max) : 0;
+}
+
 void async_close() {
     pthread_mutex_lock(&pool_mutex);
     if (pool != NULL) {
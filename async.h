@@ -2,15 +2,44 @@
 #define _TP_ASYNC_H
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/socket.h>
 
 #include "threadpool.h"
 #include "async_macros.h"
 
 typedef tpool_handle async_handle;
 typedef void *(*async_work)(void *arg);
+typedef tpool_range_body async_range_body;
+typedef tpool_config async_config;
+typedef tpool_pool async_executor;
+typedef tpool_stack_stats async_stack_stats;
+typedef tpool_priority async_priority;
+typedef tpool_stack_class async_stack_class;
+typedef tpool_stack_usage async_stack_usage;
+typedef tpool_lane_stats async_lane_stats;
+typedef tpool_worker_stats async_worker_stats;
+typedef tpool_stats async_stats;
+typedef tpool_channel async_channel;
+typedef tpool_mutex async_mutex;
+typedef tpool_sem async_sem;
+typedef tpool_cond async_cond;
+
+/**
+ * @brief How async_run_attr and async_spawn_detached_attr run a task.
+ * Zeroed fields select the default.
+ */
+typedef struct async_attr {
+    async_executor *exec;    // NULL for the one async_run picks
+    async_priority prio;
+    async_stack_class stack;
+    size_t size;             // bytes at arg to copy into the task, 0 to pass arg itself
+} async_attr;
 
 /**
  * @brief The async macro is used to define an asynchronous function.
@@ -23,11 +52,99 @@ typedef void *(*async_work)(void *arg);
  * The created function will return a handle to the asynchronous task.
  *
  * Supports 0 to 8 arguments.
- * Asserts that sizeof(return_type) <= sizeof(void *).
- * For larger returns, heap-allocate memory and return a pointer.
+ * Results larger than a pointer, such as small structs, are stored in the
+ * task's own allocation, so they cost no separate allocation. Such results
+ * must be read with the await macro or the `_into` await functions, such as
+ * async_await_into and async_await_all_into, which copy them out before the
+ * task is freed; the pointers the other await functions return dangle.
  */
 #define async(T, FUNC, ARGS...) _impl_ASYNC(T, FUNC, ##ARGS)
 
+/**
+ * @brief Scheduling classes, highest first.
+ *
+ * Workers run tasks of the highest class that has any queued, so a backlog
+ * of low priority work does not delay high priority tasks. Every so often a
+ * lower class goes first, so none of them can starve.
+ */
+#define ASYNC_PRIO_HIGH TPOOL_PRIO_HIGH
+#define ASYNC_PRIO_NORMAL TPOOL_PRIO_NORMAL
+#define ASYNC_PRIO_LOW TPOOL_PRIO_LOW
+#define ASYNC_PRIO_LEVELS TPOOL_PRIO_LEVELS
+
+/**
+ * @brief Defines an asynchronous function like the async macro, whose
+ * tasks run in scheduling class PRIO rather than ASYNC_PRIO_NORMAL.
+ *
+ * Usage is
+ * `async_prio(ASYNC_PRIO_HIGH, return_type, function_name, [arg_type1, arg_name1], ...) {
+ *    // function body
+ * }
+ */
+#define async_prio(PRIO, T, FUNC, ARGS...) _impl_ASYNC_PRIO(PRIO, T, FUNC, ##ARGS)
+
+/**
+ * @brief Task stack classes. The sizes of each are set through
+ * async_init_config, with ASYNC_STACK_DEFAULT at 64 KiB, ASYNC_STACK_SMALL
+ * at 16 KiB and ASYNC_STACK_LARGE at 1 MiB unless configured otherwise.
+ *
+ * Tasks of a class start on a stack of that size, so small leaf tasks that
+ * suspend hold a small stack and deeply recursive ones get a large stack.
+ */
+#define ASYNC_STACK_DEFAULT TPOOL_STACK_DEFAULT
+#define ASYNC_STACK_SMALL TPOOL_STACK_SMALL
+#define ASYNC_STACK_LARGE TPOOL_STACK_LARGE
+
+/**
+ * @brief Defines an asynchronous function like the async macro, whose
+ * tasks run on stacks of class STACK rather than ASYNC_STACK_DEFAULT.
+ *
+ * Usage is
+ * `async_stack(ASYNC_STACK_SMALL, return_type, function_name, [arg_type1, arg_name1], ...) {
+ *    // function body
+ * }
+ */
+#define async_stack(STACK, T, FUNC, ARGS...) _impl_ASYNC_STACK(STACK, T, FUNC, ##ARGS)
+
+/**
+ * @brief Defines an asynchronous function whose tasks run in scheduling
+ * class PRIO on stacks of class STACK.
+ */
+#define async_prio_stack(PRIO, STACK, T, FUNC, ARGS...) _impl_ASYNC_ATTR(PRIO, STACK, T, FUNC, ##ARGS)
+
+/**
+ * @brief Defines an asynchronous function that returns nothing and whose
+ * calls spawn detached tasks, with no handle to await.
+ *
+ * Usage is
+ * `async_detached(function_name, [arg_type1, arg_name1], ...) {
+ *    // function body
+ * }
+ *
+ * The created function returns void. async_close waits for its tasks.
+ */
+#define async_detached(FUNC, ARGS...) _impl_ASYNC_DETACHED(FUNC, ##ARGS)
+
+/**
+ * @brief Defines an asynchronous function like the async_detached macro,
+ * whose tasks run on executor EXEC rather than on that of the caller.
+ */
+#define async_detached_on(EXEC, FUNC, ARGS...) _impl_ASYNC_DETACHED_ON(EXEC, FUNC, ##ARGS)
+
+/**
+ * @brief Defines an asynchronous function like the async macro, whose
+ * tasks run on executor EXEC rather than on that of the caller.
+ *
+ * Usage is
+ * `async_on(exec, return_type, function_name, [arg_type1, arg_name1], ...) {
+ *    // function body
+ * }
+ *
+ * EXEC is evaluated on each call, so it may name a variable set once the
+ * executor is created.
+ */
+#define async_on(EXEC, T, FUNC, ARGS...) _impl_ASYNC_ON(EXEC, T, FUNC, ##ARGS)
+
 /**
  * @brief The await macro is used to wait for the result of an asynchronous task
  * created by a function defined with the `async` macro.
@@ -68,12 +185,60 @@ typedef void *(*async_work)(void *arg);
  * async_close will do nothing. Calls made while async_close is running will
  * block until async_close returns, then run.
  *
- * @param num_threads The number of threads to use. 0 for default.
+ * @param num_threads The number of threads to use. 0 for one per CPU the
+ * process may run on.
  */
 void async_init(size_t num_threads);
 
 /**
- * @brief Runs a non-async `void *` to `void *` function asynchronously
+ * @brief Initializes the async library like async_init, with the thread
+ * count and its upper bound, task stack sizes, stack cache size, CPU
+ * pinning and affinity, thread niceness, tracing and stack profiling taken
+ * from config. Zeroed fields select the defaults.
+ *
+ * @param config The pool configuration.
+ */
+void async_init_config(const async_config *config);
+
+/**
+ * @brief Creates an executor: a threadpool of its own, apart from the
+ * default one started by async_init, so that workloads such as latency
+ * sensitive request handling and batch jobs do not compete for workers.
+ * Each has its own threads, stacks and queues, configured like
+ * async_init_config; set cpus and nice in config to keep it off the CPUs of
+ * other executors or to run it at a different thread priority.
+ *
+ * Tasks spawned without naming an executor, by async functions or
+ * async_run, run on the executor of the task spawning them, or on the
+ * default executor outside of any. Tasks of any executor may await those
+ * of any other.
+ *
+ * @param config The executor configuration.
+ * @return async_executor* The executor, or NULL on failure.
+ */
+async_executor *async_executor_create(const async_config *config);
+
+/**
+ * @brief Closes an executor created by async_executor_create once its tasks
+ * are done, like async_close. Must not be called from its own tasks.
+ * Handles of its tasks, wherever they are awaited, must be awaited first.
+ */
+void async_executor_close(async_executor *exec);
+
+/**
+ * @brief Returns the executor started by async_init, or NULL before then.
+ */
+async_executor *async_default_executor(void);
+
+/**
+ * @brief Returns the executor running the calling task, or NULL outside of
+ * asynchronous functions.
+ */
+async_executor *async_current_executor(void);
+
+/**
+ * @brief Runs a non-async `void *` to `void *` function asynchronously, on
+ * the executor of the calling task or the default one outside of any.
  *
  * @param work The function to run.
  * @param arg The argument to pass to the function.
@@ -81,6 +246,84 @@ void async_init(size_t num_threads);
  */
 async_handle *async_run(async_work work, void *arg);
 
+/**
+ * @brief Runs a non-async `void *` to `void *` function asynchronously in
+ * scheduling class prio.
+ *
+ * @param work The function to run.
+ * @param arg The argument to pass to the function.
+ * @param prio The scheduling class, one of the ASYNC_PRIO constants.
+ * @return async_handle* A handle to the asynchronous task.
+ */
+async_handle *async_run_prio(async_work work, void *arg, async_priority prio);
+
+/**
+ * @brief Runs work on arg like async_run, on executor exec.
+ *
+ * @param exec The executor to run on. NULL for the one async_run picks.
+ * @param work The function to run.
+ * @param arg The argument to pass to the function.
+ * @return async_handle* A handle to the asynchronous task.
+ */
+async_handle *async_run_on(async_executor *exec, async_work work, void *arg);
+
+/**
+ * @brief Runs work on arg as attr describes: on executor attr.exec, in
+ * scheduling class attr.prio, on a stack of class attr.stack. A nonzero
+ * attr.size runs work on a copy of that many bytes at arg, stored with the
+ * task so no separate allocation is needed for the argument.
+ *
+ * @param work The function to run, which receives arg or its copy.
+ * @param arg The argument to pass or copy.
+ * @param attr How to run the task.
+ * @return async_handle* A handle to the asynchronous task.
+ */
+async_handle *async_run_attr(async_work work, void *arg, async_attr attr);
+
+/**
+ * @brief Runs a non-async `void *` to `void *` function asynchronously
+ * without a handle, for work whose result nobody reads, such as flushing a
+ * log. The task is freed as soon as it finishes, and async_close still
+ * waits for it.
+ *
+ * @param work The function to run.
+ * @param arg The argument to pass to the function.
+ */
+void async_spawn_detached(async_work work, void *arg);
+
+/**
+ * @brief Runs work on arg like async_spawn_detached, as attr describes for
+ * async_run_attr.
+ */
+void async_spawn_detached_attr(async_work work, void *arg, async_attr attr);
+
+/**
+ * @brief Runs work on each of n arguments asynchronously. Cheaper than n
+ * calls to async_run, since the tasks are queued all at once.
+ *
+ * @param work The function to run.
+ * @param args The arguments to pass to each task.
+ * @param n The number of tasks.
+ * @param handles Filled with a handle to each task.
+ */
+void async_run_batch(async_work work, void **args, size_t n, async_handle **handles);
+
+/**
+ * @brief Calls body on subranges of [begin, end) in parallel and waits for
+ * all of them.
+ *
+ * Subranges are about grain elements long. The range is only split up while
+ * other workers are idle, so large ranges do not create large numbers of
+ * tasks.
+ *
+ * @param begin The start of the range.
+ * @param end The end of the range, exclusive.
+ * @param grain The number of elements worth running as one call.
+ * @param body Called with each subrange and arg.
+ * @param arg Passed to body.
+ */
+void async_parallel_for(size_t begin, size_t end, size_t grain, async_range_body body, void *arg);
+
 /**
  * @brief Waits for the result of an asynchronous task.
  *
@@ -92,9 +335,450 @@ async_handle *async_run(async_work work, void *arg);
 void *async_await(async_handle *handle);
 
 /**
- * @brief Closes the global threadpool.
+ * @brief Waits for the result of an asynchronous task whose result is larger
+ * than a pointer, and copies it to result. Used by the await macro.
+ *
+ * @param handle The handle to the asynchronous task.
+ * @param result Where to copy the result to.
+ * @param size The size of the result.
+ * @return void* result.
+ */
+void *async_await_into(async_handle *handle, void *result, size_t size);
+
+/**
+ * @brief Waits for the results of n asynchronous tasks at once. Suspends the
+ * current task at most once, rather than once per handle.
+ *
+ * @param handles The handles to the asynchronous tasks.
+ * @param n The number of handles.
+ * @param results Filled with the result of each task. May be NULL.
+ */
+void async_await_all(async_handle **handles, size_t n, void **results);
+
+/**
+ * @brief Waits for n asynchronous tasks like async_await_all, for tasks
+ * whose results are larger than a pointer.
+ *
+ * @param handles The handles to the asynchronous tasks.
+ * @param n The number of handles.
+ * @param results An array of n results of size bytes each, filled with the
+ * result of each task.
+ * @param size The size of a result.
+ */
+void async_await_all_into(async_handle **handles, size_t n, void *results, size_t size);
+
+/**
+ * @brief Waits until the first of n asynchronous tasks finishes.
+ *
+ * Only the handle of the finished task is consumed; the others remain valid
+ * and must still be awaited.
+ *
+ * @param handles The handles to the asynchronous tasks.
+ * @param n The number of handles, at least 1.
+ * @param index Set to the index of the finished task. May be NULL.
+ * @return void* The result of the finished task.
+ */
+void *async_await_any(async_handle **handles, size_t n, size_t *index);
+
+/**
+ * @brief Waits until the first of n asynchronous tasks finishes like
+ * async_await_any, for tasks whose results are larger than a pointer, and
+ * copies its result to result.
+ *
+ * @return void* result.
+ */
+void *async_await_any_into(async_handle **handles, size_t n, size_t *index, void *result, size_t size);
+
+/**
+ * @brief Returns the current time in nanoseconds on the monotonic clock that
+ * deadlines are measured against.
+ */
+uint64_t async_now(void);
+
+/**
+ * @brief Returns the deadline ns nanoseconds from now.
+ */
+uint64_t async_deadline(uint64_t ns);
+
+/**
+ * @brief Suspends the current task for at least ns nanoseconds, leaving the
+ * worker free to run other tasks. Outside of asynchronous functions this
+ * blocks the calling thread.
+ */
+void async_sleep(uint64_t ns);
+
+/**
+ * @brief Suspends the current task until deadline, as returned by
+ * async_deadline.
+ */
+void async_sleep_until(uint64_t deadline);
+
+/**
+ * @brief Calls a function which may block the thread, such as a read from a
+ * file, letting the threadpool start an extra thread to run other tasks
+ * meanwhile if it has to.
+ *
+ * @param work The function to call.
+ * @param arg The argument to pass to the function.
+ * @return void* The result of work.
+ */
+void *async_blocking(async_work work, void *arg);
+
+/**
+ * @brief Waits for the result of an asynchronous task for at most ns
+ * nanoseconds.
+ *
+ * Never runs the awaited task inline, unlike async_await.
+ *
+ * @param handle The handle to the asynchronous task.
+ * @param ns The timeout.
+ * @param result Set to the result of the task if it finished. May be NULL.
+ * @return bool Whether the task finished. If it did not, the handle remains
+ * valid and must still be awaited.
+ */
+bool async_await_timeout(async_handle *handle, uint64_t ns, void **result);
+
+/**
+ * @brief Waits for the result of an asynchronous task like
+ * async_await_timeout, until deadline rather than for a duration.
+ */
+bool async_await_until(async_handle *handle, uint64_t deadline, void **result);
+
+/**
+ * @brief Waits like async_await_timeout, for a task whose result is larger
+ * than a pointer, and copies it to result if the task finished.
+ */
+bool async_await_timeout_into(async_handle *handle, uint64_t ns, void *result, size_t size);
+
+/**
+ * @brief Waits like async_await_until, for a task whose result is larger
+ * than a pointer, and copies it to result if the task finished.
+ */
+bool async_await_until_into(async_handle *handle, uint64_t deadline, void *result, size_t size);
+
+/**
+ * @brief Reads from fd like read(2), suspending the current task instead of
+ * blocking while no data is available.
+ *
+ * fd must be in non-blocking mode. Outside of asynchronous functions this
+ * blocks the calling thread.
+ *
+ * @return ssize_t The number of bytes read, or -1 with errno set.
+ */
+ssize_t async_read(int fd, void *buf, size_t count);
+
+/**
+ * @brief Writes to fd like write(2), suspending the current task instead of
+ * blocking while fd is not writable. May write less than count bytes.
+ *
+ * fd must be in non-blocking mode.
+ *
+ * @return ssize_t The number of bytes written, or -1 with errno set.
+ */
+ssize_t async_write(int fd, const void *buf, size_t count);
+
+/**
+ * @brief Accepts a connection on the listening socket fd like accept(2),
+ * suspending the current task until one arrives.
+ *
+ * fd must be in non-blocking mode. The returned socket is non-blocking too.
+ *
+ * @return int The connected socket, or -1 with errno set.
+ */
+int async_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+
+/**
+ * @brief Connects the socket fd like connect(2), suspending the current task
+ * until the connection is established or fails.
+ *
+ * fd must be in non-blocking mode.
+ *
+ * @return int 0, or -1 with errno set.
+ */
+int async_connect(int fd, const struct sockaddr *addr, socklen_t addrlen);
+
+/**
+ * @brief Creates a bounded channel for passing pointers between tasks.
+ *
+ * Any number of tasks or threads may send and receive. Tasks waiting on a
+ * full or empty channel are suspended, and resumed by the task on the other
+ * side, rather than blocking their worker.
+ *
+ * @param capacity The number of items buffered, at least 1.
+ * @return async_channel* The channel, or NULL on failure.
+ */
+async_channel *async_channel_init(size_t capacity);
+
+/**
+ * @brief Frees a channel no task is waiting on.
+ */
+void async_channel_free(async_channel *channel);
+
+/**
+ * @brief Sends item, suspending the current task while the channel is full.
+ *
+ * @return int 0, or -1 with errno set to EPIPE if the channel is closed.
+ */
+int async_channel_send(async_channel *channel, void *item);
+
+/**
+ * @brief Sends item only if the channel has room.
+ *
+ * @return int 0, or -1 with errno set to EAGAIN if the channel is full or
+ * EPIPE if it is closed.
+ */
+int async_channel_try_send(async_channel *channel, void *item);
+
+/**
+ * @brief Receives the oldest item, suspending the current task while the
+ * channel is empty.
+ *
+ * @return int 0, or -1 with errno set to EPIPE once the channel is closed
+ * and every item sent before has been received.
+ */
+int async_channel_recv(async_channel *channel, void **item);
+
+/**
+ * @brief Receives the oldest item only if there is one.
+ *
+ * @return int 0, or -1 with errno set to EAGAIN if the channel is empty or
+ * EPIPE if it is also closed.
+ */
+int async_channel_try_recv(async_channel *channel, void **item);
+
+/**
+ * @brief Receives up to max items at once, suspending the current task
+ * while the channel is empty. Cheaper per item than async_channel_recv, and
+ * senders waiting for room are woken together.
+ *
+ * @return size_t The number of items received, 0 once the channel is closed
+ * and drained.
+ */
+size_t async_channel_recv_many(async_channel *channel, void **items, size_t max);
+
+/**
+ * @brief Receives up to max items at once like async_channel_recv_many,
+ * only those already queued.
+ *
+ * @return size_t The number of items received, 0 if the channel is empty.
+ */
+size_t async_channel_try_recv_many(async_channel *channel, void **items, size_t max);
+
+/**
+ * @brief Closes a channel. Waiting tasks are resumed, further sends fail,
+ * and items already sent can still be received.
+ */
+void async_channel_close(async_channel *channel);
+
+/**
+ * @brief Creates a mutex for asynchronous functions.
+ *
+ * Unlike a pthread mutex, a task waiting for it is suspended after spinning
+ * briefly, leaving its worker free to run other tasks. The mutex is handed
+ * directly to the longest waiting task on unlock. Threads outside the pool
+ * may use it too, and block while waiting.
+ *
+ * @return async_mutex* The mutex, or NULL on failure.
+ */
+async_mutex *async_mutex_init(void);
+
+/**
+ * @brief Frees a mutex no task is waiting on.
+ */
+void async_mutex_free(async_mutex *mutex);
+
+/**
+ * @brief Locks a mutex, suspending the current task while it is held.
+ */
+void async_mutex_lock(async_mutex *mutex);
+
+/**
+ * @brief Locks a mutex only if it is free.
+ *
+ * @return bool Whether the mutex was locked.
+ */
+bool async_mutex_try_lock(async_mutex *mutex);
+
+/**
+ * @brief Unlocks a mutex held by the caller.
+ */
+void async_mutex_unlock(async_mutex *mutex);
+
+/**
+ * @brief Creates a counting semaphore for asynchronous functions.
+ *
+ * @param count The initial number of units.
+ * @return async_sem* The semaphore, or NULL on failure.
+ */
+async_sem *async_sem_init(size_t count);
+
+/**
+ * @brief Frees a semaphore no task is waiting on.
+ */
+void async_sem_free(async_sem *sem);
+
+/**
+ * @brief Takes a unit, suspending the current task while there are none.
+ */
+void async_sem_wait(async_sem *sem);
+
+/**
+ * @brief Takes a unit only if there is one.
+ *
+ * @return bool Whether a unit was taken.
+ */
+bool async_sem_try_wait(async_sem *sem);
+
+/**
+ * @brief Adds a unit, handing it directly to the longest waiting task if
+ * there is one.
+ */
+void async_sem_post(async_sem *sem);
+
+/**
+ * @brief Creates a condition variable for use with an async_mutex.
+ *
+ * @return async_cond* The condition variable, or NULL on failure.
+ */
+async_cond *async_cond_init(void);
+
+/**
+ * @brief Frees a condition variable no task is waiting on.
+ */
+void async_cond_free(async_cond *cond);
+
+/**
+ * @brief Unlocks mutex and suspends the current task until the condition
+ * variable is signaled, then returns with mutex locked again.
+ *
+ * All tasks waiting at the same time must use the same mutex.
+ */
+void async_cond_wait(async_cond *cond, async_mutex *mutex);
+
+/**
+ * @brief Wakes the longest waiting task, if any.
+ */
+void async_cond_signal(async_cond *cond);
+
+/**
+ * @brief Wakes every waiting task. Each is resumed once it gets the mutex.
+ */
+void async_cond_broadcast(async_cond *cond);
+
+/**
+ * @brief Takes a snapshot of the current executor, the one running the
+ * calling task or the default one outside of any: the number of workers,
+ * tasks in flight, and the scheduler counters of all workers summed up.
+ *
+ * The counters are kept per worker and only summed here, so reading them is
+ * meant for periodic export rather than for every task.
+ *
+ * @param stats Filled with the snapshot, zeroed if there is no executor.
+ */
+void async_stats_snapshot(async_stats *stats);
+
+/**
+ * @brief Takes a snapshot like async_stats_snapshot, of executor exec.
+ */
+void async_stats_snapshot_on(async_executor *exec, async_stats *stats);
+
+/**
+ * @brief Reads the scheduler counters of each worker of the current
+ * executor.
+ *
+ * @param stats Filled with the counters of up to max workers.
+ * @param max The number of entries stats has room for.
+ * @return size_t The number of workers, which may exceed max, or 0 if there
+ * is no executor.
+ */
+size_t async_get_worker_stats(async_worker_stats *stats, size_t max);
+
+/**
+ * @brief Reads worker counters like async_get_worker_stats, of executor exec.
+ */
+size_t async_get_worker_stats_on(async_executor *exec, async_worker_stats *stats, size_t max);
+
+/**
+ * @brief Writes the scheduler events traced by the current executor to the
+ * file at path as Chrome trace-event JSON, to be loaded in Perfetto. Tracing
+ * is enabled by setting trace_events in the executor config.
+ *
+ * @param path The file to write.
+ * @return int 0, or -1 with errno set on failure. errno is EINVAL if there
+ * is no executor.
+ */
+int async_trace_dump(const char *path);
+
+/**
+ * @brief Writes traced events like async_trace_dump, of executor exec.
+ */
+int async_trace_dump_on(async_executor *exec, const char *path);
+
+/**
+ * @brief Reads the queue counters of each scheduling class of the current
+ * executor: tasks queued, tasks taken, and the mean and longest time
+ * tasks waited to run.
+ *
+ * @param stats Filled with the counters of each class, indexed by the
+ * ASYNC_PRIO constants. Zeroed if there is no executor.
+ */
+void async_get_lane_stats(async_lane_stats stats[ASYNC_PRIO_LEVELS]);
+
+/**
+ * @brief Reads queue counters like async_get_lane_stats, of executor exec.
+ */
+void async_get_lane_stats_on(async_executor *exec, async_lane_stats stats[ASYNC_PRIO_LEVELS]);
+
+/**
+ * @brief Reads the task stack cache counters of the current executor: cache
+ * hits, misses (new mappings) and bytes of stack memory that may be resident.
+ *
+ * @param stats Filled with the sums over all workers, zeroed if there is no
+ * executor.
+ */
+void async_get_stack_stats(async_stack_stats *stats);
+
+/**
+ * @brief Reads stack cache counters like async_get_stack_stats, of executor
+ * exec.
+ */
+void async_get_stack_stats_on(async_executor *exec, async_stack_stats *stats);
+
+/**
+ * @brief Bytes of stack use the stack profiler cannot resolve.
+ */
+#define ASYNC_STACK_PROFILE_FLOOR TPOOL_STACK_PROFILE_FLOOR
+
+/**
+ * @brief Reads how much stack each task function run by the current
+ * executor used at most, deepest first, to size its stack class. Stack
+ * profiling is enabled by setting stack_profile in the executor config; it
+ * paints task stacks, which slows down every task.
+ *
+ * Functions are identified by their task entry point, which for async
+ * functions is named after the function, as addr2line or dladdr show.
+ * Functions using at most ASYNC_STACK_PROFILE_FLOOR bytes show 0, since
+ * the profiler cannot measure that close to where a task starts.
+ *
+ * @param usage Filled with the stack use of each function.
+ * @param max The most functions to store.
+ * @return size_t The number of functions stored, 0 if there is no executor.
+ */
+size_t async_get_stack_profile(async_stack_usage *usage, size_t max);
+
+/**
+ * @brief Reads stack use like async_get_stack_profile, of executor exec.
+ */
+size_t async_get_stack_profile_on(async_executor *exec, async_stack_usage *usage, size_t max);
+
+/**
+ * @brief Closes the global threadpool, the default executor. Executors
+ * created by async_executor_create are closed by async_executor_close.
  *
- * Waits until all workers are waiting for tasks, then exits.
+ * Waits until all workers are waiting for tasks, then exits. Handles of
+ * tasks run on it must be awaited first: their records are freed with the
+ * executor, so awaiting one afterwards, even from another executor, is
+ * undefined.
  */
 void async_close();
 
@@ -1,190 +1,413 @@
 #ifndef TPOOL__ASYNC_MACROS_H
 #define TPOOL__ASYNC_MACROS_H
 
-#define _ASYNC_8(T_RET, FUNC, T0, N0, T1, N1, T2, N2, T3, N3, T4, N4, T5, N5, T6, N6, T7, N7)\
+/*
+ * Results up to the size of a pointer are returned as the pointer itself.
+ * Larger ones are written over the copy of the arguments stored with the
+ * task, which the task has read by then, and returned by address, so the
+ * arguments are given room for them.
+ */
+#define _ASYNC_RET_SIZE(T_RET) (sizeof(T_RET) > sizeof(void *) ? sizeof(T_RET) : 1)
+
+#define _ASYNC_RESULT(T_RET, RET, ARG)\
+    (sizeof(T_RET) <= sizeof(void *) ? ((union {T_RET x; void *y;}) {.x = RET}).y : memcpy(ARG, &RET, sizeof(T_RET)))
+
+#define _ASYNC_8(ATTR, T_RET, FUNC, T0, N0, T1, N1, T2, N2, T3, N3, T4, N4, T5, N5, T6, N6, T7, N7)\
 T_RET _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5, T6 N6, T7 N7);\
-typedef struct {\
-    T0 N0; T1 N1; T2 N2; T3 N3;\
-    T4 N4; T5 N5; T6 N6; T7 N7;\
+typedef union {\
+    struct {\
+        T0 N0; T1 N1; T2 N2; T3 N3;\
+        T4 N4; T5 N5; T6 N6; T7 N7;\
+    };\
+    char _async_ret[_ASYNC_RET_SIZE(T_RET)];\
 } _async_##FUNC##_args;\
 void *_async_int_vv_##FUNC(void *arg) {\
-    assert(sizeof(T_RET) <= sizeof(void *));\
     _async_##FUNC##_args *ARGS = arg;\
     T_RET ret = _async_int_##FUNC(\
         ARGS->N0, ARGS->N1, ARGS->N2, ARGS->N3,\
         ARGS->N4, ARGS->N5, ARGS->N6, ARGS->N7);\
-    free(arg);\
-    return ((union {T_RET x; void *y;}) {.x = ret}).y;\
+    return _ASYNC_RESULT(T_RET, ret, arg);\
 }\
 async_handle *FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5, T6 N6, T7 N7) {\
-    _async_##FUNC##_args *_async_arg = malloc(sizeof(_async_##FUNC##_args));\
-    _async_arg->N0 = N0; _async_arg->N1 = N1; _async_arg->N2 = N2; _async_arg->N3 = N3;\
-    _async_arg->N4 = N4; _async_arg->N5 = N5; _async_arg->N6 = N6; _async_arg->N7 = N7;\
-    return async_run(_async_int_vv_##FUNC, _async_arg);\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0; _async_arg.N1 = N1; _async_arg.N2 = N2; _async_arg.N3 = N3;\
+    _async_arg.N4 = N4; _async_arg.N5 = N5; _async_arg.N6 = N6; _async_arg.N7 = N7;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    return async_run_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
 }\
 T_RET _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5, T6 N6, T7 N7)
 
-#define _ASYNC_7(T_RET, FUNC, T0, N0, T1, N1, T2, N2, T3, N3, T4, N4, T5, N5, T6, N6)\
+#define _ASYNC_7(ATTR, T_RET, FUNC, T0, N0, T1, N1, T2, N2, T3, N3, T4, N4, T5, N5, T6, N6)\
 T_RET _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5, T6 N6);\
-typedef struct {\
-    T0 N0; T1 N1; T2 N2; T3 N3;\
-    T4 N4; T5 N5; T6 N6;\
+typedef union {\
+    struct {\
+        T0 N0; T1 N1; T2 N2; T3 N3;\
+        T4 N4; T5 N5; T6 N6;\
+    };\
+    char _async_ret[_ASYNC_RET_SIZE(T_RET)];\
 } _async_##FUNC##_args;\
 void *_async_int_vv_##FUNC(void *arg) {\
-    assert(sizeof(T_RET) <= sizeof(void *));\
     _async_##FUNC##_args *ARGS = arg;\
     T_RET ret = _async_int_##FUNC(\
         ARGS->N0, ARGS->N1, ARGS->N2, ARGS->N3,\
         ARGS->N4, ARGS->N5, ARGS->N6);\
-    free(arg);\
-    return ((union {T_RET x; void *y;}) {.x = ret}).y;\
+    return _ASYNC_RESULT(T_RET, ret, arg);\
 }\
 async_handle *FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5, T6 N6) {\
-    _async_##FUNC##_args *_async_arg = malloc(sizeof(_async_##FUNC##_args));\
-    _async_arg->N0 = N0; _async_arg->N1 = N1; _async_arg->N2 = N2; _async_arg->N3 = N3;\
-    _async_arg->N4 = N4; _async_arg->N5 = N5; _async_arg->N6 = N6;\
-    return async_run(_async_int_vv_##FUNC, _async_arg);\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0; _async_arg.N1 = N1; _async_arg.N2 = N2; _async_arg.N3 = N3;\
+    _async_arg.N4 = N4; _async_arg.N5 = N5; _async_arg.N6 = N6;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    return async_run_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
 }\
 T_RET _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5, T6 N6)
 
-#define _ASYNC_6(T_RET, FUNC, T0, N0, T1, N1, T2, N2, T3, N3, T4, N4, T5, N5)\
+#define _ASYNC_6(ATTR, T_RET, FUNC, T0, N0, T1, N1, T2, N2, T3, N3, T4, N4, T5, N5)\
 T_RET _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5);\
-typedef struct {\
-    T0 N0; T1 N1; T2 N2; T3 N3;\
-    T4 N4; T5 N5;\
+typedef union {\
+    struct {\
+        T0 N0; T1 N1; T2 N2; T3 N3;\
+        T4 N4; T5 N5;\
+    };\
+    char _async_ret[_ASYNC_RET_SIZE(T_RET)];\
 } _async_##FUNC##_args;\
 void *_async_int_vv_##FUNC(void *arg) {\
-    assert(sizeof(T_RET) <= sizeof(void *));\
     _async_##FUNC##_args *ARGS = arg;\
     T_RET ret = _async_int_##FUNC(\
         ARGS->N0, ARGS->N1, ARGS->N2, ARGS->N3,\
         ARGS->N4, ARGS->N5);\
-    free(arg);\
-    return ((union {T_RET x; void *y;}) {.x = ret}).y;\
+    return _ASYNC_RESULT(T_RET, ret, arg);\
 }\
 async_handle *FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5) {\
-    _async_##FUNC##_args *_async_arg = malloc(sizeof(_async_##FUNC##_args));\
-    _async_arg->N0 = N0; _async_arg->N1 = N1; _async_arg->N2 = N2; _async_arg->N3 = N3;\
-    _async_arg->N4 = N4; _async_arg->N5 = N5;\
-    return async_run(_async_int_vv_##FUNC, _async_arg);\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0; _async_arg.N1 = N1; _async_arg.N2 = N2; _async_arg.N3 = N3;\
+    _async_arg.N4 = N4; _async_arg.N5 = N5;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    return async_run_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
 }\
 T_RET _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5)
 
-#define _ASYNC_5(T_RET, FUNC, T0, N0, T1, N1, T2, N2, T3, N3, T4, N4)\
+#define _ASYNC_5(ATTR, T_RET, FUNC, T0, N0, T1, N1, T2, N2, T3, N3, T4, N4)\
 T_RET _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4);\
-typedef struct {\
-    T0 N0; T1 N1; T2 N2; T3 N3;\
-    T4 N4;\
+typedef union {\
+    struct {\
+        T0 N0; T1 N1; T2 N2; T3 N3;\
+        T4 N4;\
+    };\
+    char _async_ret[_ASYNC_RET_SIZE(T_RET)];\
 } _async_##FUNC##_args;\
 void *_async_int_vv_##FUNC(void *arg) {\
-    assert(sizeof(T_RET) <= sizeof(void *));\
     _async_##FUNC##_args *ARGS = arg;\
     T_RET ret = _async_int_##FUNC(\
         ARGS->N0, ARGS->N1, ARGS->N2, ARGS->N3,\
         ARGS->N4);\
-    free(arg);\
-    return ((union {T_RET x; void *y;}) {.x = ret}).y;\
+    return _ASYNC_RESULT(T_RET, ret, arg);\
 }\
 async_handle *FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4) {\
-    _async_##FUNC##_args *_async_arg = malloc(sizeof(_async_##FUNC##_args));\
-    _async_arg->N0 = N0; _async_arg->N1 = N1; _async_arg->N2 = N2; _async_arg->N3 = N3;\
-    _async_arg->N4 = N4;\
-    return async_run(_async_int_vv_##FUNC, _async_arg);\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0; _async_arg.N1 = N1; _async_arg.N2 = N2; _async_arg.N3 = N3;\
+    _async_arg.N4 = N4;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    return async_run_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
 }\
 T_RET _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4)
 
-#define _ASYNC_4(T_RET, FUNC, T0, N0, T1, N1, T2, N2, T3, N3)\
+#define _ASYNC_4(ATTR, T_RET, FUNC, T0, N0, T1, N1, T2, N2, T3, N3)\
 T_RET _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3);\
-typedef struct {\
-    T0 N0; T1 N1; T2 N2; T3 N3;\
+typedef union {\
+    struct {\
+        T0 N0; T1 N1; T2 N2; T3 N3;\
+    };\
+    char _async_ret[_ASYNC_RET_SIZE(T_RET)];\
 } _async_##FUNC##_args;\
 void *_async_int_vv_##FUNC(void *arg) {\
-    assert(sizeof(T_RET) <= sizeof(void *));\
     _async_##FUNC##_args *ARGS = arg;\
     T_RET ret = _async_int_##FUNC(\
         ARGS->N0, ARGS->N1, ARGS->N2, ARGS->N3);\
-    free(arg);\
-    return ((union {T_RET x; void *y;}) {.x = ret}).y;\
+    return _ASYNC_RESULT(T_RET, ret, arg);\
 }\
 async_handle *FUNC(T0 N0, T1 N1, T2 N2, T3 N3) {\
-    _async_##FUNC##_args *_async_arg = malloc(sizeof(_async_##FUNC##_args));\
-    _async_arg->N0 = N0; _async_arg->N1 = N1; _async_arg->N2 = N2; _async_arg->N3 = N3;\
-    return async_run(_async_int_vv_##FUNC, _async_arg);\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0; _async_arg.N1 = N1; _async_arg.N2 = N2; _async_arg.N3 = N3;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    return async_run_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
 }\
 T_RET _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3)
 
-#define _ASYNC_3(T_RET, FUNC, T0, N0, T1, N1, T2, N2)\
+#define _ASYNC_3(ATTR, T_RET, FUNC, T0, N0, T1, N1, T2, N2)\
 T_RET _async_int_##FUNC(T0 N0, T1 N1, T2 N2);\
-typedef struct {\
-    T0 N0; T1 N1; T2 N2;\
+typedef union {\
+    struct {\
+        T0 N0; T1 N1; T2 N2;\
+    };\
+    char _async_ret[_ASYNC_RET_SIZE(T_RET)];\
 } _async_##FUNC##_args;\
 void *_async_int_vv_##FUNC(void *arg) {\
-    assert(sizeof(T_RET) <= sizeof(void *));\
     _async_##FUNC##_args *ARGS = arg;\
     T_RET ret = _async_int_##FUNC(\
         ARGS->N0, ARGS->N1, ARGS->N2);\
-    free(arg);\
-    return ((union {T_RET x; void *y;}) {.x = ret}).y;\
+    return _ASYNC_RESULT(T_RET, ret, arg);\
 }\
 async_handle *FUNC(T0 N0, T1 N1, T2 N2) {\
-    _async_##FUNC##_args *_async_arg = malloc(sizeof(_async_##FUNC##_args));\
-    _async_arg->N0 = N0; _async_arg->N1 = N1; _async_arg->N2 = N2;\
-    return async_run(_async_int_vv_##FUNC, _async_arg);\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0; _async_arg.N1 = N1; _async_arg.N2 = N2;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    return async_run_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
 }\
 T_RET _async_int_##FUNC(T0 N0, T1 N1, T2 N2)
 
-#define _ASYNC_2(T_RET, FUNC, T0, N0, T1, N1)\
+#define _ASYNC_2(ATTR, T_RET, FUNC, T0, N0, T1, N1)\
 T_RET _async_int_##FUNC(T0 N0, T1 N1);\
-typedef struct {\
-    T0 N0; T1 N1;\
+typedef union {\
+    struct {\
+        T0 N0; T1 N1;\
+    };\
+    char _async_ret[_ASYNC_RET_SIZE(T_RET)];\
 } _async_##FUNC##_args;\
 void *_async_int_vv_##FUNC(void *arg) {\
-    assert(sizeof(T_RET) <= sizeof(void *));\
     _async_##FUNC##_args *ARGS = arg;\
     T_RET ret = _async_int_##FUNC(\
         ARGS->N0, ARGS->N1);\
-    free(arg);\
-    return ((union {T_RET x; void *y;}) {.x = ret}).y;\
+    return _ASYNC_RESULT(T_RET, ret, arg);\
 }\
 async_handle *FUNC(T0 N0, T1 N1) {\
-    _async_##FUNC##_args *_async_arg = malloc(sizeof(_async_##FUNC##_args));\
-    _async_arg->N0 = N0; _async_arg->N1 = N1;\
-    return async_run(_async_int_vv_##FUNC, _async_arg);\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0; _async_arg.N1 = N1;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    return async_run_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
 }\
 T_RET _async_int_##FUNC(T0 N0, T1 N1)
 
-#define _ASYNC_1(T_RET, FUNC, T0, N0)\
+#define _ASYNC_1(ATTR, T_RET, FUNC, T0, N0)\
 T_RET _async_int_##FUNC(T0 N0);\
-typedef struct {\
-    T0 N0;\
+typedef union {\
+    struct {\
+        T0 N0;\
+    };\
+    char _async_ret[_ASYNC_RET_SIZE(T_RET)];\
 } _async_##FUNC##_args;\
 void *_async_int_vv_##FUNC(void *arg) {\
-    assert(sizeof(T_RET) <= sizeof(void *));\
     _async_##FUNC##_args *ARGS = arg;\
     T_RET ret = _async_int_##FUNC(ARGS->N0);\
-    free(arg);\
-    return ((union {T_RET x; void *y;}) {.x = ret}).y;\
+    return _ASYNC_RESULT(T_RET, ret, arg);\
 }\
 async_handle *FUNC(T0 N0) {\
-    _async_##FUNC##_args *_async_arg = malloc(sizeof(_async_##FUNC##_args));\
-    _async_arg->N0 = N0;\
-    return async_run(_async_int_vv_##FUNC, _async_arg);\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    return async_run_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
 }\
 T_RET _async_int_##FUNC(T0 N0)
 
 
-#define _ASYNC_0(T_RET, FUNC)\
+#define _ASYNC_0(ATTR, T_RET, FUNC)\
 T_RET _async_int_##FUNC();\
 void *_async_int_vv_##FUNC(void *arg) {\
-    assert(sizeof(T_RET) <= sizeof(void *));\
-    (void) arg;\
-    return ((union {T_RET x; void *y;}) {.x = _async_int_##FUNC()}).y;;\
+    T_RET ret = _async_int_##FUNC();\
+    return _ASYNC_RESULT(T_RET, ret, arg);\
 }\
 async_handle *FUNC() {\
-    return async_run(_async_int_vv_##FUNC, NULL);\
+    async_attr _async_attr = ATTR;\
+    if (sizeof(T_RET) <= sizeof(void *)) {\
+        return async_run_attr(_async_int_vv_##FUNC, NULL, _async_attr);\
+    }\
+    char _async_ret[_ASYNC_RET_SIZE(T_RET)] = {0};\
+    _async_attr.size = sizeof(_async_ret);\
+    return async_run_attr(_async_int_vv_##FUNC, _async_ret, _async_attr);\
 }\
 T_RET _async_int_##FUNC()
 
+#define _ASYNC_DETACHED_8(ATTR, FUNC, T0, N0, T1, N1, T2, N2, T3, N3, T4, N4, T5, N5, T6, N6, T7, N7)\
+void _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5, T6 N6, T7 N7);\
+typedef struct {\
+    T0 N0; T1 N1; T2 N2; T3 N3;\
+    T4 N4; T5 N5; T6 N6; T7 N7;\
+} _async_##FUNC##_args;\
+void *_async_int_vv_##FUNC(void *arg) {\
+    _async_##FUNC##_args *ARGS = arg;\
+    _async_int_##FUNC(\
+        ARGS->N0, ARGS->N1, ARGS->N2, ARGS->N3,\
+        ARGS->N4, ARGS->N5, ARGS->N6, ARGS->N7);\
+    return NULL;\
+}\
+void FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5, T6 N6, T7 N7) {\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0; _async_arg.N1 = N1; _async_arg.N2 = N2; _async_arg.N3 = N3;\
+    _async_arg.N4 = N4; _async_arg.N5 = N5; _async_arg.N6 = N6; _async_arg.N7 = N7;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    async_spawn_detached_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
+}\
+void _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5, T6 N6, T7 N7)
+
+#define _ASYNC_DETACHED_7(ATTR, FUNC, T0, N0, T1, N1, T2, N2, T3, N3, T4, N4, T5, N5, T6, N6)\
+void _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5, T6 N6);\
+typedef struct {\
+    T0 N0; T1 N1; T2 N2; T3 N3;\
+    T4 N4; T5 N5; T6 N6;\
+} _async_##FUNC##_args;\
+void *_async_int_vv_##FUNC(void *arg) {\
+    _async_##FUNC##_args *ARGS = arg;\
+    _async_int_##FUNC(\
+        ARGS->N0, ARGS->N1, ARGS->N2, ARGS->N3,\
+        ARGS->N4, ARGS->N5, ARGS->N6);\
+    return NULL;\
+}\
+void FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5, T6 N6) {\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0; _async_arg.N1 = N1; _async_arg.N2 = N2; _async_arg.N3 = N3;\
+    _async_arg.N4 = N4; _async_arg.N5 = N5; _async_arg.N6 = N6;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    async_spawn_detached_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
+}\
+void _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5, T6 N6)
+
+#define _ASYNC_DETACHED_6(ATTR, FUNC, T0, N0, T1, N1, T2, N2, T3, N3, T4, N4, T5, N5)\
+void _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5);\
+typedef struct {\
+    T0 N0; T1 N1; T2 N2; T3 N3;\
+    T4 N4; T5 N5;\
+} _async_##FUNC##_args;\
+void *_async_int_vv_##FUNC(void *arg) {\
+    _async_##FUNC##_args *ARGS = arg;\
+    _async_int_##FUNC(\
+        ARGS->N0, ARGS->N1, ARGS->N2, ARGS->N3,\
+        ARGS->N4, ARGS->N5);\
+    return NULL;\
+}\
+void FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5) {\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0; _async_arg.N1 = N1; _async_arg.N2 = N2; _async_arg.N3 = N3;\
+    _async_arg.N4 = N4; _async_arg.N5 = N5;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    async_spawn_detached_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
+}\
+void _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4, T5 N5)
+
+#define _ASYNC_DETACHED_5(ATTR, FUNC, T0, N0, T1, N1, T2, N2, T3, N3, T4, N4)\
+void _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4);\
+typedef struct {\
+    T0 N0; T1 N1; T2 N2; T3 N3;\
+    T4 N4;\
+} _async_##FUNC##_args;\
+void *_async_int_vv_##FUNC(void *arg) {\
+    _async_##FUNC##_args *ARGS = arg;\
+    _async_int_##FUNC(\
+        ARGS->N0, ARGS->N1, ARGS->N2, ARGS->N3,\
+        ARGS->N4);\
+    return NULL;\
+}\
+void FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4) {\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0; _async_arg.N1 = N1; _async_arg.N2 = N2; _async_arg.N3 = N3;\
+    _async_arg.N4 = N4;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    async_spawn_detached_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
+}\
+void _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3, T4 N4)
+
+#define _ASYNC_DETACHED_4(ATTR, FUNC, T0, N0, T1, N1, T2, N2, T3, N3)\
+void _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3);\
+typedef struct {\
+    T0 N0; T1 N1; T2 N2; T3 N3;\
+} _async_##FUNC##_args;\
+void *_async_int_vv_##FUNC(void *arg) {\
+    _async_##FUNC##_args *ARGS = arg;\
+    _async_int_##FUNC(\
+        ARGS->N0, ARGS->N1, ARGS->N2, ARGS->N3);\
+    return NULL;\
+}\
+void FUNC(T0 N0, T1 N1, T2 N2, T3 N3) {\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0; _async_arg.N1 = N1; _async_arg.N2 = N2; _async_arg.N3 = N3;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    async_spawn_detached_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
+}\
+void _async_int_##FUNC(T0 N0, T1 N1, T2 N2, T3 N3)
+
+#define _ASYNC_DETACHED_3(ATTR, FUNC, T0, N0, T1, N1, T2, N2)\
+void _async_int_##FUNC(T0 N0, T1 N1, T2 N2);\
+typedef struct {\
+    T0 N0; T1 N1; T2 N2;\
+} _async_##FUNC##_args;\
+void *_async_int_vv_##FUNC(void *arg) {\
+    _async_##FUNC##_args *ARGS = arg;\
+    _async_int_##FUNC(\
+        ARGS->N0, ARGS->N1, ARGS->N2);\
+    return NULL;\
+}\
+void FUNC(T0 N0, T1 N1, T2 N2) {\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0; _async_arg.N1 = N1; _async_arg.N2 = N2;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    async_spawn_detached_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
+}\
+void _async_int_##FUNC(T0 N0, T1 N1, T2 N2)
+
+#define _ASYNC_DETACHED_2(ATTR, FUNC, T0, N0, T1, N1)\
+void _async_int_##FUNC(T0 N0, T1 N1);\
+typedef struct {\
+    T0 N0; T1 N1;\
+} _async_##FUNC##_args;\
+void *_async_int_vv_##FUNC(void *arg) {\
+    _async_##FUNC##_args *ARGS = arg;\
+    _async_int_##FUNC(\
+        ARGS->N0, ARGS->N1);\
+    return NULL;\
+}\
+void FUNC(T0 N0, T1 N1) {\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0; _async_arg.N1 = N1;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    async_spawn_detached_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
+}\
+void _async_int_##FUNC(T0 N0, T1 N1)
+
+#define _ASYNC_DETACHED_1(ATTR, FUNC, T0, N0)\
+void _async_int_##FUNC(T0 N0);\
+typedef struct {\
+    T0 N0;\
+} _async_##FUNC##_args;\
+void *_async_int_vv_##FUNC(void *arg) {\
+    _async_##FUNC##_args *ARGS = arg;\
+    _async_int_##FUNC(ARGS->N0);\
+    return NULL;\
+}\
+void FUNC(T0 N0) {\
+    _async_##FUNC##_args _async_arg;\
+    _async_arg.N0 = N0;\
+    async_attr _async_attr = ATTR;\
+    _async_attr.size = sizeof(_async_arg);\
+    async_spawn_detached_attr(_async_int_vv_##FUNC, &_async_arg, _async_attr);\
+}\
+void _async_int_##FUNC(T0 N0)
+
+#define _ASYNC_DETACHED_0(ATTR, FUNC)\
+void _async_int_##FUNC();\
+void *_async_int_vv_##FUNC(void *arg) {\
+    (void) arg;\
+    _async_int_##FUNC();\
+    return NULL;\
+}\
+void FUNC() {\
+    async_spawn_detached_attr(_async_int_vv_##FUNC, NULL, ATTR);\
+}\
+void _async_int_##FUNC()
+
 #define INVALID_ARG_COUNT(...) typedef int _ASYNC_INVALID_ARG_COUNT[-1]; void _ASYNC_INVALID_ARG_COUNT_FUNC()
 
 #define GET_17TH_ARG(A0, A1, A2, A3, A4, A5, A6, A7, A8, A9, A10, A11, A12, A13, A14, A15, A16, ...) A16
@@ -195,9 +418,45 @@ T_RET _async_int_##FUNC()
         INVALID_ARG_COUNT, _ASYNC_5, INVALID_ARG_COUNT, _ASYNC_4, INVALID_ARG_COUNT, _ASYNC_3,\
         INVALID_ARG_COUNT, _ASYNC_2, INVALID_ARG_COUNT, _ASYNC_1, _ASYNC_0)
 
-#define _impl_ASYNC(T_RET, FUNC, ARGS...) _ASYNC_DISPATH(ARGS)(T_RET, FUNC, ##ARGS)
+#define _ASYNC_DETACHED_DISPATH(ARGS...)\
+    GET_17TH_ARG(ARGS\
+        INVALID_ARG_COUNT, _ASYNC_DETACHED_8, INVALID_ARG_COUNT, _ASYNC_DETACHED_7,\
+        INVALID_ARG_COUNT, _ASYNC_DETACHED_6, INVALID_ARG_COUNT, _ASYNC_DETACHED_5,\
+        INVALID_ARG_COUNT, _ASYNC_DETACHED_4, INVALID_ARG_COUNT, _ASYNC_DETACHED_3,\
+        INVALID_ARG_COUNT, _ASYNC_DETACHED_2, INVALID_ARG_COUNT, _ASYNC_DETACHED_1, _ASYNC_DETACHED_0)
+
+// a NULL executor spawns on that of the caller
+#define _impl_ASYNC_ATTR(PRIO, STACK, T_RET, FUNC, ARGS...)\
+    _ASYNC_DISPATH(ARGS)(((async_attr) {.exec = NULL, .prio = PRIO, .stack = STACK}), T_RET, FUNC, ##ARGS)
 
-#define _impl_AWAIT(T, EXPR...) ((union {T x; void *y;}) {.y = async_await(EXPR)}).x
+#define _impl_ASYNC_ON(EXEC, T_RET, FUNC, ARGS...)\
+    _ASYNC_DISPATH(ARGS)(((async_attr) {.exec = (EXEC), .prio = ASYNC_PRIO_NORMAL, .stack = ASYNC_STACK_DEFAULT}),\
+        T_RET, FUNC, ##ARGS)
+
+#define _impl_ASYNC(T_RET, FUNC, ARGS...) _impl_ASYNC_ATTR(ASYNC_PRIO_NORMAL, ASYNC_STACK_DEFAULT, T_RET, FUNC, ##ARGS)
+
+#define _impl_ASYNC_PRIO(PRIO, T_RET, FUNC, ARGS...) _impl_ASYNC_ATTR(PRIO, ASYNC_STACK_DEFAULT, T_RET, FUNC, ##ARGS)
+
+#define _impl_ASYNC_STACK(STACK, T_RET, FUNC, ARGS...) _impl_ASYNC_ATTR(ASYNC_PRIO_NORMAL, STACK, T_RET, FUNC, ##ARGS)
+
+#define _impl_ASYNC_DETACHED(FUNC, ARGS...) _impl_ASYNC_DETACHED_ON(NULL, FUNC, ##ARGS)
+
+#define _impl_ASYNC_DETACHED_ON(EXEC, FUNC, ARGS...)\
+    _ASYNC_DETACHED_DISPATH(ARGS)(((async_attr) {.exec = (EXEC), .prio = ASYNC_PRIO_NORMAL, .stack = ASYNC_STACK_DEFAULT}),\
+        FUNC, ##ARGS)
+
+// large results are copied out before the task and its arguments are freed.
+// A statement expression, so that an await whose result is unused is not a
+// discarded value
+#define _impl_AWAIT(T, EXPR...) ({\
+    union {T x; void *y;} _async_result;\
+    if (sizeof(T) <= sizeof(void *)) {\
+        _async_result.y = async_await(EXPR);\
+    } else {\
+        async_await_into(EXPR, &_async_result.x, sizeof(T));\
+    }\
+    _async_result.x;\
+})
 
 #define _impl_YIELD tpool_yield
 
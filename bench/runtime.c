@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "async.h"
+
+/*
+ * Runtime microbenchmarks, each timed over several samples at every thread
+ * count from 1 to the number of CPUs, doubling, and reported as percentiles
+ * of ns/op and ops/sec. Prints CSV, or JSON lines with --json.
+ *
+ * Usage: bench_runtime [--json] [--threads N] [--samples N]
+ */
+
+#define DEFAULT_SAMPLES 15
+#define MAX_SAMPLES 1000
+#define FANOUT_CHILDREN 1000
+
+typedef struct bench {
+    const char *name;
+    // operations per sample
+    size_t ops;
+    // runs ops operations inside the pool
+    void (*run)(size_t ops);
+} bench;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+async(intptr_t, empty) {
+    return 0;
+}
+
+async(intptr_t, spawn_await_loop, size_t, ops) {
+    for (size_t i = 0; i < ops; i++) {
+        async_await(empty());
+    }
+    return 0;
+}
+
+static void run_spawn_await(size_t ops) {
+    async_await(spawn_await_loop(ops));
+}
+
+static _Atomic int turn;
+
+async(intptr_t, ping_pong, int, me, size_t, rounds) {
+    for (size_t i = 0; i < rounds; i++) {
+        yield_while(atomic_load_explicit(&turn, memory_order_acquire) != me);
+        atomic_store_explicit(&turn, !me, memory_order_release);
+    }
+    return 0;
+}
+
+// one op is one handoff, so each task takes half of them
+static void run_ping_pong(size_t ops) {
+    atomic_store(&turn, 0);
+    async_handle *ping = ping_pong(0, ops / 2);
+    async_handle *pong = ping_pong(1, ops / 2);
+    async_await(ping);
+    async_await(pong);
+}
+
+async(intptr_t, fib, intptr_t, n) {
+    if (n <= 1) {
+        return n;
+    }
+    async_handle *a = fib(n - 1);
+    async_handle *b = fib(n - 2);
+    return await(intptr_t, a) + await(intptr_t, b);
+}
+
+// one op is one task; fib(30) spawns 2 * fib(31) - 1 of them
+static void run_fib(size_t ops) {
+    (void) ops;
+    async_await(fib(30));
+}
+
+async(intptr_t, empty_tasks, size_t, ops) {
+    async_handle **handles = malloc(ops * sizeof(async_handle *));
+    for (size_t i = 0; i < ops; i++) {
+        handles[i] = empty();
+    }
+    async_await_all(handles, ops, NULL);
+    free(handles);
+    return 0;
+}
+
+static void run_empty_tasks(size_t ops) {
+    async_await(empty_tasks(ops));
+}
+
+async(intptr_t, fan_out, size_t, rounds) {
+    async_handle *handles[FANOUT_CHILDREN];
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < FANOUT_CHILDREN; i++) {
+            handles[i] = empty();
+        }
+        async_await_all(handles, FANOUT_CHILDREN, NULL);
+    }
+    return 0;
+}
+
+// one op is a round of spawning and awaiting all children
+static void run_fan_out(size_t ops) {
+    async_await(fan_out(ops));
+}
+
+static const bench benches[] = {
+    {"spawn_await", 200000, run_spawn_await},
+    {"yield_ping_pong", 200000, run_ping_pong},
+    {"fib30", 2692537, run_fib},
+    {"empty_tasks", 200000, run_empty_tasks},
+    {"fan_out_1k", 200, run_fan_out},
+};
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// nearest rank, on sorted values
+static double percentile(const double *values, size_t count, double p) {
+    size_t rank = (size_t) (p / 100.0 * count + 0.5);
+    rank = rank < 1 ? 1 : rank > count ? count : rank;
+    return values[rank - 1];
+}
+
+static void report(const bench *b, size_t threads, double *ns, size_t samples, bool json) {
+    qsort(ns, samples, sizeof(double), compare_doubles);
+    double p50 = percentile(ns, samples, 50);
+    double p90 = percentile(ns, samples, 90);
+    double p99 = percentile(ns, samples, 99);
+    // the fastest samples give the highest rates, so the rate percentiles
+    // are taken from the other end
+    if (json) {
+        printf("{\"bench\":\"%s\",\"threads\":%zu,\"ops\":%zu,\"samples\":%zu,"
+            "\"ns_per_op\":{\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f},"
+            "\"ops_per_sec\":{\"p50\":%.0f,\"p10\":%.0f,\"p1\":%.0f}}\n",
+            b->name, threads, b->ops, samples, p50, p90, p99, 1e9 / p50, 1e9 / p90, 1e9 / p99);
+    } else {
+        printf("%s,%zu,%zu,%zu,%.2f,%.2f,%.2f,%.0f,%.0f,%.0f\n",
+            b->name, threads, b->ops, samples, p50, p90, p99, 1e9 / p50, 1e9 / p90, 1e9 / p99);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    bool json = false;
+    long max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t samples = DEFAULT_SAMPLES;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--json")) {
+            json = true;
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            max_threads = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--samples") && i + 1 < argc) {
+            samples = (size_t) atol(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--json] [--threads N] [--samples N]\n", argv[0]);
+            return 1;
+        }
+    }
+    max_threads = max_threads < 1 ? 1 : max_threads;
+    samples = samples < 1 ? 1 : samples > MAX_SAMPLES ? MAX_SAMPLES : samples;
+
+    if (!json) {
+        printf("bench,threads,ops,samples,ns_p50,ns_p90,ns_p99,ops_per_sec_p50,ops_per_sec_p10,ops_per_sec_p1\n");
+    }
+    double ns[MAX_SAMPLES];
+    for (size_t threads = 1, next; threads <= (size_t) max_threads; threads = next) {
+        async_init(threads);
+        for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+            // warm up the stack caches and slabs
+            benches[b].run(benches[b].ops / 10 + 1);
+            for (size_t s = 0; s < samples; s++) {
+                double start = now();
+                benches[b].run(benches[b].ops);
+                ns[s] = (now() - start) * 1e9 / benches[b].ops;
+            }
+            report(&benches[b], threads, ns, samples, json);
+        }
+        async_close();
+        next = threads * 2;
+        // the last round runs at the full count even if it is not a power of two
+        if (threads < (size_t) max_threads && next > (size_t) max_threads) {
+            next = (size_t) max_threads;
+        }
+    }
+    return 0;
+}
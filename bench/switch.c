@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "async.h"
+#include "context.h"
+
+#define SWITCH_ROUNDS 1000000
+#define YIELD_ROUNDS 1000000
+
+static tpool_context main_context;
+static tpool_context fiber_context;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fiber_entry() {
+    while (true) {
+        tpool_context_switch(&fiber_context, &main_context);
+    }
+}
+
+async(intptr_t, yielder, intptr_t, n) {
+    for (intptr_t i = 0; i < n; i++) {
+        yield();
+    }
+    return n;
+}
+
+int main() {
+#ifdef TPOOL_UCONTEXT
+    const char *backend = "ucontext";
+#else
+    const char *backend = "asm";
+#endif
+    static char stack[1 << 16];
+    tpool_context_make(&fiber_context, stack, sizeof(stack), fiber_entry);
+
+    double start = now();
+    for (size_t i = 0; i < SWITCH_ROUNDS; i++) {
+        tpool_context_switch(&main_context, &fiber_context);
+    }
+    double switch_ns = (now() - start) * 1e9 / (2.0 * SWITCH_ROUNDS);
+
+    // two tasks on one worker take turns, so that every yield switches to
+    // the other rather than returning right away
+    async_init(1);
+    start = now();
+    async_handle *ping = yielder(YIELD_ROUNDS);
+    async_handle *pong = yielder(YIELD_ROUNDS);
+    async_await(ping);
+    async_await(pong);
+    double yield_ns = (now() - start) * 1e9 / (2.0 * YIELD_ROUNDS);
+    async_close();
+
+    printf("%-8s switch: %7.1f ns  yield: %7.1f ns\n", backend, switch_ns, yield_ns);
+    return 0;
+}
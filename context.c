@@ -0,0 +1,130 @@
+#define _XOPEN_SOURCE
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "context.h"
+
+#ifdef TPOOL_UCONTEXT
+
+void tpool_context_make(tpool_context *ctx, void *stack, size_t size, void (*entry)(void)) {
+    getcontext(ctx);
+    ctx->uc_stack = (stack_t) {
+        .ss_sp = stack,
+        .ss_size = size,
+        .ss_flags = 0
+    };
+    ctx->uc_link = NULL;
+    makecontext(ctx, entry, 0);
+}
+
+void tpool_context_switch(tpool_context *from, tpool_context *to) {
+    swapcontext(from, to);
+}
+
+#else
+
+#ifdef __APPLE__
+#define ASM_FUNC(NAME) ".globl _" #NAME "\n" ".p2align 4\n" "_" #NAME ":\n"
+#else
+#define ASM_FUNC(NAME) ".globl " #NAME "\n" ".type " #NAME ", %function\n" ".p2align 4\n" #NAME ":\n"
+#endif
+
+#if defined(__x86_64__)
+
+/*
+ * Saved frame, from the saved stack pointer up:
+ * mxcsr, x87 control word, r15, r14, r13, r12, rbx, rbp, return address
+ */
+__asm__ (
+    ".text\n"
+    ASM_FUNC(tpool_context_switch)
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq (%rsi), %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+);
+
+void tpool_context_make(tpool_context *ctx, void *stack, size_t size, void (*entry)(void)) {
+    uintptr_t top = ((uintptr_t) stack + size) & ~(uintptr_t) 15;
+    uint64_t *sp = (uint64_t *) top - 9;
+    // default mxcsr and x87 control word
+    sp[0] = 0x1F80 | ((uint64_t) 0x037F << 32);
+    for (int i = 1; i <= 6; i++) {
+        sp[i] = 0;
+    }
+    // entry is reached by ret with the stack aligned as after a call
+    sp[7] = (uint64_t) entry;
+    sp[8] = 0;
+    ctx->sp = sp;
+}
+
+#elif defined(__aarch64__)
+
+/*
+ * Saved frame, from the saved stack pointer up:
+ * x19-x28, x29 (fp), x30 (lr), d8-d15
+ */
+__asm__ (
+    ".text\n"
+    ASM_FUNC(tpool_context_switch)
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x2, sp\n"
+    "    str x2, [x0]\n"
+    "    ldr x2, [x1]\n"
+    "    mov sp, x2\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+);
+
+void tpool_context_make(tpool_context *ctx, void *stack, size_t size, void (*entry)(void)) {
+    uintptr_t top = ((uintptr_t) stack + size) & ~(uintptr_t) 15;
+    uint64_t *sp = (uint64_t *) top - 20;
+    for (int i = 0; i < 20; i++) {
+        sp[i] = 0;
+    }
+    // entry is reached by ret through the saved link register
+    sp[11] = (uint64_t) entry;
+    ctx->sp = sp;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef TPOOL_CONTEXT_H
+#define TPOOL_CONTEXT_H
+
+#include <stdlib.h>
+
+/**
+ * Execution contexts for task fibers.
+ *
+ * On x86-64 and aarch64 switching is done by a hand-written routine which
+ * only saves the callee-saved registers on the stack being switched away
+ * from. Elsewhere, or when built with -DTPOOL_UCONTEXT, ucontext is used,
+ * which also saves the signal mask at the cost of a syscall per switch.
+ */
+#if !defined(TPOOL_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define TPOOL_UCONTEXT
+#endif
+
+#ifdef TPOOL_UCONTEXT
+#include <ucontext.h>
+
+typedef ucontext_t tpool_context;
+#else
+typedef struct tpool_context {
+    void *sp;
+} tpool_context;
+#endif
+
+/**
+ * Prepares ctx to run entry on the stack [stack, stack + size) when it is
+ * first switched to. entry must never return.
+ */
+void tpool_context_make(tpool_context *ctx, void *stack, size_t size, void (*entry)(void));
+
+/**
+ * Saves the current context into from and resumes to. Returns when another
+ * context switches back to from, possibly on a different thread.
+ */
+void tpool_context_switch(tpool_context *from, tpool_context *to);
+
+#endif
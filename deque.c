@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "deque.h"
+
+const size_t TPOOL_MIN_DEQUE_SIZE = 64;
+
+static tpool_deque_array *deque_array_init(size_t size) {
+    tpool_deque_array *array = malloc(sizeof(tpool_deque_array) + size * sizeof(void *));
+    assert(array != NULL && "Allocation failed in deque_array_init");
+    array->size = size;
+    array->prev = NULL;
+    return array;
+}
+
+static void *array_get(tpool_deque_array *array, int64_t i) {
+    return atomic_load_explicit(&array->data[i & (array->size - 1)], memory_order_relaxed);
+}
+
+static void array_put(tpool_deque_array *array, int64_t i, void *item) {
+    atomic_store_explicit(&array->data[i & (array->size - 1)], item, memory_order_relaxed);
+}
+
+static tpool_deque_array *deque_grow(tpool_deque *deque, tpool_deque_array *old, int64_t bottom, int64_t top) {
+    tpool_deque_array *array = deque_array_init(old->size * 2);
+    for (int64_t i = top; i < bottom; i++) {
+        array_put(array, i, array_get(old, i));
+    }
+    // thieves may still hold a pointer to the old array
+    array->prev = old;
+    atomic_store_explicit(&deque->array, array, memory_order_release);
+    return array;
+}
+
+void tpool_deque_init(tpool_deque *deque) {
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    atomic_init(&deque->array, deque_array_init(TPOOL_MIN_DEQUE_SIZE));
+}
+
+void tpool_deque_free(tpool_deque *deque) {
+    tpool_deque_array *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    while (array != NULL) {
+        tpool_deque_array *prev = array->prev;
+        free(array);
+        array = prev;
+    }
+}
+
+void tpool_deque_push(tpool_deque *deque, void *item) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    tpool_deque_array *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    if (bottom - top > (int64_t) array->size - 1) {
+        array = deque_grow(deque, array, bottom, top);
+    }
+    array_put(array, bottom, item);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+void *tpool_deque_pop(tpool_deque *deque) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    tpool_deque_array *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        // empty
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+    void *item = array_get(array, bottom);
+    if (top == bottom) {
+        // last item, race against thieves for it
+        if (!atomic_compare_exchange_strong_explicit(
+            &deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed
+        )) {
+            item = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return item;
+}
+
+void *tpool_deque_steal(tpool_deque *deque) {
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (top >= bottom) {
+        return NULL;
+    }
+    tpool_deque_array *array = atomic_load_explicit(&deque->array, memory_order_acquire);
+    void *item = array_get(array, top);
+    if (!atomic_compare_exchange_strong_explicit(
+        &deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed
+    )) {
+        return NULL;
+    }
+    return item;
+}
+
+size_t tpool_deque_size(tpool_deque *deque) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    return bottom > top ? (size_t) (bottom - top) : 0;
+}
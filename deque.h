@@ -0,0 +1,52 @@
+#ifndef TPOOL_DEQUE_H
+#define TPOOL_DEQUE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/**
+ * Chase-Lev work-stealing deque.
+ *
+ * The owning thread pushes and pops at the bottom, any other thread may steal
+ * from the top. The backing array grows as needed; retired arrays are kept
+ * until the deque is freed since a thief may still be reading from them.
+ */
+typedef struct tpool_deque_array {
+    size_t size;
+    struct tpool_deque_array *prev;
+    _Atomic(void *) data[];
+} tpool_deque_array;
+
+typedef struct tpool_deque {
+    _Alignas(64) _Atomic int64_t top;
+    _Alignas(64) _Atomic int64_t bottom;
+    _Atomic(tpool_deque_array *) array;
+} tpool_deque;
+
+void tpool_deque_init(tpool_deque *deque);
+
+void tpool_deque_free(tpool_deque *deque);
+
+/**
+ * Pushes item onto the bottom of the deque. Owner only.
+ */
+void tpool_deque_push(tpool_deque *deque, void *item);
+
+/**
+ * Pops the most recently pushed item. Owner only. Returns NULL when empty.
+ */
+void *tpool_deque_pop(tpool_deque *deque);
+
+/**
+ * Steals the oldest item. Safe from any thread. Returns NULL when empty or
+ * when the steal lost a race with the owner or another thief.
+ */
+void *tpool_deque_steal(tpool_deque *deque);
+
+/**
+ * Approximate number of items, for heuristics only.
+ */
+size_t tpool_deque_size(tpool_deque *deque);
+
+#endif
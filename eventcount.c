@@ -0,0 +1,39 @@
+#include <limits.h>
+
+#include "eventcount.h"
+#include "futex.h"
+
+void tpool_eventcount_init(tpool_eventcount *ec) {
+    atomic_init(&ec->epoch, 0);
+    atomic_init(&ec->waiters, 0);
+}
+
+uint32_t tpool_eventcount_prepare(tpool_eventcount *ec) {
+    atomic_fetch_add(&ec->waiters, 1);
+    return atomic_load(&ec->epoch);
+}
+
+void tpool_eventcount_cancel(tpool_eventcount *ec) {
+    atomic_fetch_sub_explicit(&ec->waiters, 1, memory_order_relaxed);
+}
+
+void tpool_eventcount_wait(tpool_eventcount *ec, uint32_t key, const struct timespec *timeout) {
+    if (atomic_load(&ec->epoch) == key) {
+        tpool_futex_wait_for(&ec->epoch, key, timeout);
+    }
+    atomic_fetch_sub_explicit(&ec->waiters, 1, memory_order_relaxed);
+}
+
+bool tpool_eventcount_has_waiters(tpool_eventcount *ec) {
+    // pairs with the waiter registering before it rechecks its condition
+    atomic_thread_fence(memory_order_seq_cst);
+    return atomic_load_explicit(&ec->waiters, memory_order_relaxed) > 0;
+}
+
+void tpool_eventcount_notify(tpool_eventcount *ec, int count) {
+    if (!tpool_eventcount_has_waiters(ec)) {
+        return;
+    }
+    atomic_fetch_add(&ec->epoch, 1);
+    tpool_futex_wake(&ec->epoch, count);
+}
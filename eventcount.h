@@ -0,0 +1,47 @@
+#ifndef TPOOL_EVENTCOUNT_H
+#define TPOOL_EVENTCOUNT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/**
+ * Eventcount for sleeping until some condition holds without a lock.
+ *
+ * A waiter calls tpool_eventcount_prepare, rechecks its condition, then
+ * either cancels or waits with the returned key. A notifier changes the
+ * condition before calling tpool_eventcount_notify, which costs a single
+ * load when nobody is waiting.
+ */
+typedef struct tpool_eventcount {
+    _Atomic uint32_t epoch;
+    _Atomic uint32_t waiters;
+} tpool_eventcount;
+
+void tpool_eventcount_init(tpool_eventcount *ec);
+
+/**
+ * Registers the caller as a waiter. Returns the key to wait with.
+ */
+uint32_t tpool_eventcount_prepare(tpool_eventcount *ec);
+
+void tpool_eventcount_cancel(tpool_eventcount *ec);
+
+/**
+ * Sleeps unless a notification came after the key was taken, or until
+ * timeout, which may be NULL. Unregisters the caller in either case.
+ */
+void tpool_eventcount_wait(tpool_eventcount *ec, uint32_t key, const struct timespec *timeout);
+
+/**
+ * Returns true if a waiter may be registered.
+ */
+bool tpool_eventcount_has_waiters(tpool_eventcount *ec);
+
+/**
+ * Wakes up to count waiters, if there are any.
+ */
+void tpool_eventcount_notify(tpool_eventcount *ec, int count);
+
+#endif
@@ -0,0 +1,76 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "futex.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+void tpool_futex_wait_for(_Atomic uint32_t *addr, uint32_t expected, const struct timespec *timeout) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+void tpool_futex_wake(_Atomic uint32_t *addr, int count) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+#else
+
+#define TPOOL_FUTEX_BUCKETS 64
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} buckets[TPOOL_FUTEX_BUCKETS];
+static pthread_once_t buckets_once = PTHREAD_ONCE_INIT;
+
+static void buckets_init() {
+    for (size_t i = 0; i < TPOOL_FUTEX_BUCKETS; i++) {
+        pthread_mutex_init(&buckets[i].mutex, NULL);
+        pthread_cond_init(&buckets[i].cond, NULL);
+    }
+}
+
+static size_t bucket_of(_Atomic uint32_t *addr) {
+    pthread_once(&buckets_once, buckets_init);
+    return ((uintptr_t) addr >> 2) % TPOOL_FUTEX_BUCKETS;
+}
+
+void tpool_futex_wait_for(_Atomic uint32_t *addr, uint32_t expected, const struct timespec *timeout) {
+    size_t i = bucket_of(addr);
+    pthread_mutex_lock(&buckets[i].mutex);
+    if (atomic_load(addr) == expected) {
+        if (timeout == NULL) {
+            pthread_cond_wait(&buckets[i].cond, &buckets[i].mutex);
+        } else {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += timeout->tv_sec;
+            deadline.tv_nsec += timeout->tv_nsec;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&buckets[i].cond, &buckets[i].mutex, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&buckets[i].mutex);
+}
+
+void tpool_futex_wake(_Atomic uint32_t *addr, int count) {
+    (void) count;
+    size_t i = bucket_of(addr);
+    pthread_mutex_lock(&buckets[i].mutex);
+    pthread_cond_broadcast(&buckets[i].cond);
+    pthread_mutex_unlock(&buckets[i].mutex);
+}
+
+#endif
+
+void tpool_futex_wait(_Atomic uint32_t *addr, uint32_t expected) {
+    tpool_futex_wait_for(addr, expected, NULL);
+}
@@ -0,0 +1,26 @@
+#ifndef TPOOL_FUTEX_H
+#define TPOOL_FUTEX_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/**
+ * Blocks while *addr == expected, until woken by tpool_futex_wake. May return
+ * spuriously. Uses futex(2) on Linux and a hashed table of condition
+ * variables elsewhere.
+ */
+void tpool_futex_wait(_Atomic uint32_t *addr, uint32_t expected);
+
+/**
+ * Like tpool_futex_wait, but gives up after timeout, which may be NULL to
+ * wait indefinitely.
+ */
+void tpool_futex_wait_for(_Atomic uint32_t *addr, uint32_t expected, const struct timespec *timeout);
+
+/**
+ * Wakes up to count threads blocked on addr.
+ */
+void tpool_futex_wake(_Atomic uint32_t *addr, int count);
+
+#endif
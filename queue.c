@@ -7,14 +7,6 @@
 const size_t TPOOL_MIN_LIST_SIZE = 4;
 const size_t TPOOL_LIST_SCALE = 2;
 
-static void *lock_get(pthread_mutex_t *mutex, void **loc) {
-    pthread_mutex_lock(mutex);
-    void *item = *loc;
-    pthread_mutex_unlock(mutex);
-    return item;
-}
-
-
 void tpool_list_init(tpool_list *list) {
     list->alloc_size = 0;
     list->count = 0;
@@ -51,11 +43,7 @@ tpool_queue *tpool_queue_init() {
 
     tpool_list_init(&queue->in);
     tpool_list_init(&queue->out);
-    queue->count = 0;
-    queue->unblock = false;
-
-    assert(!pthread_mutex_init(&queue->new_mut, NULL));
-    assert(!pthread_cond_init(&queue->new_cond, NULL));
+    atomic_init(&queue->count, 0);
 
     return queue;
 }
@@ -70,32 +58,26 @@ void tpool_enqueue(tpool_queue *queue, void *item) {
     pthread_mutex_lock(&queue->body_mutex);
 
     tpool_list_push(&queue->in, item);
-    queue->count++;
+    atomic_fetch_add_explicit(&queue->count, 1, memory_order_release);
 
     pthread_mutex_unlock(&queue->body_mutex);
-
-    pthread_mutex_lock(&queue->new_mut);
-    pthread_cond_signal(&queue->new_cond);
-    pthread_mutex_unlock(&queue->new_mut);
 }
 
-void tpool_queue_unblock(tpool_queue *queue) {
-    pthread_mutex_lock(&queue->new_mut);
-    queue->unblock = true;
-    pthread_cond_broadcast(&queue->new_cond);
-    pthread_mutex_unlock(&queue->new_mut);
-}
+void tpool_enqueue_many(tpool_queue *queue, void *const *items, size_t count) {
+    pthread_mutex_lock(&queue->body_mutex);
 
-void tpool_queue_wait(tpool_queue *queue) {
-    pthread_mutex_lock(&queue->new_mut);
-    while (!queue->unblock && (size_t) lock_get(&queue->body_mutex, (void **) &queue->count) == 0) {
-        pthread_cond_wait(&queue->new_cond, &queue->new_mut);
+    for (size_t i = 0; i < count; i++) {
+        tpool_list_push(&queue->in, items[i]);
     }
-    pthread_mutex_unlock(&queue->new_mut);
+    atomic_fetch_add_explicit(&queue->count, count, memory_order_release);
+
+    pthread_mutex_unlock(&queue->body_mutex);
 }
 
 void *tpool_dequeue(tpool_queue *queue) {
-    tpool_queue_wait(queue);
+    if (tpool_queue_count(queue) == 0) {
+        return NULL;
+    }
 
     void *ret;
     pthread_mutex_lock(&queue->body_mutex);
@@ -112,10 +94,14 @@ void *tpool_dequeue(tpool_queue *queue) {
     // if the out list has something, pop it
     if (queue->out.count > 0) {
         ret = tpool_list_pop(&queue->out);
-        queue->count--;
+        atomic_fetch_sub_explicit(&queue->count, 1, memory_order_relaxed);
     } else {
         ret = NULL;
     }
     pthread_mutex_unlock(&queue->body_mutex);
     return ret;
+}
+
+size_t tpool_queue_count(tpool_queue *queue) {
+    return atomic_load_explicit(&queue->count, memory_order_acquire);
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 typedef struct tpool_list {
     size_t alloc_size;
@@ -15,10 +17,7 @@ typedef struct tpool_queue {
     pthread_mutex_t body_mutex;
     tpool_list in;
     tpool_list out;
-    size_t count;
-    pthread_mutex_t new_mut;
-    pthread_cond_t new_cond;
-    bool unblock;
+    _Atomic size_t count;
 } tpool_queue;
 
 void tpool_list_init(tpool_list *list);
@@ -35,10 +34,19 @@ void tpool_queue_free(tpool_queue *queue);
 
 void tpool_enqueue(tpool_queue *queue, void *item);
 
-void tpool_queue_unblock(tpool_queue *queue);
-
-void tpool_queue_wait(tpool_queue *queue);
+/**
+ * Adds count items, oldest first, under a single lock.
+ */
+void tpool_enqueue_many(tpool_queue *queue, void *const *items, size_t count);
 
+/**
+ * Removes the oldest item. Returns NULL without locking if the queue is empty.
+ */
 void *tpool_dequeue(tpool_queue *queue);
 
+/**
+ * Number of items in the queue, read without locking.
+ */
+size_t tpool_queue_count(tpool_queue *queue);
+
 #endif
\ No newline at end of file
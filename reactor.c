@@ -0,0 +1,198 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <errno.h>
+
+#include "reactor.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define TPOOL_REACTOR_CHUNK 1024
+#define TPOOL_REACTOR_CHUNKS 1024
+#define TPOOL_REACTOR_EVENTS 64
+
+// slot states other than a waiter pointer
+#define SLOT_EMPTY ((uintptr_t) 0)
+#define SLOT_READY ((uintptr_t) 1)
+
+#define INTERRUPT_KEY UINT64_MAX
+
+typedef struct tpool_io_slot {
+    _Atomic uintptr_t waiters[2];
+} tpool_io_slot;
+
+struct tpool_reactor {
+    int epoll_fd;
+    int event_fd;
+    // slots by fd, allocated a chunk at a time so they never move
+    _Atomic(tpool_io_slot *) chunks[TPOOL_REACTOR_CHUNKS];
+};
+
+tpool_reactor *tpool_reactor_init(void) {
+    tpool_reactor *reactor = malloc(sizeof(tpool_reactor));
+    if (reactor == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < TPOOL_REACTOR_CHUNKS; i++) {
+        atomic_init(&reactor->chunks[i], NULL);
+    }
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    reactor->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event event = {.events = EPOLLIN, .data.u64 = INTERRUPT_KEY};
+    if (reactor->epoll_fd < 0 || reactor->event_fd < 0
+        || epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->event_fd, &event)) {
+        tpool_reactor_free(reactor);
+        return NULL;
+    }
+    return reactor;
+}
+
+void tpool_reactor_free(tpool_reactor *reactor) {
+    if (reactor->epoll_fd >= 0) {
+        close(reactor->epoll_fd);
+    }
+    if (reactor->event_fd >= 0) {
+        close(reactor->event_fd);
+    }
+    for (size_t i = 0; i < TPOOL_REACTOR_CHUNKS; i++) {
+        free(atomic_load(&reactor->chunks[i]));
+    }
+    free(reactor);
+}
+
+static tpool_io_slot *slot_of(tpool_reactor *reactor, int fd, bool create) {
+    if (fd < 0 || fd >= TPOOL_REACTOR_CHUNK * TPOOL_REACTOR_CHUNKS) {
+        return NULL;
+    }
+    _Atomic(tpool_io_slot *) *chunk = &reactor->chunks[fd / TPOOL_REACTOR_CHUNK];
+    tpool_io_slot *slots = atomic_load_explicit(chunk, memory_order_acquire);
+    if (slots == NULL && create) {
+        tpool_io_slot *fresh = calloc(TPOOL_REACTOR_CHUNK, sizeof(tpool_io_slot));
+        if (fresh == NULL) {
+            return NULL;
+        }
+        if (atomic_compare_exchange_strong_explicit(
+            chunk, &slots, fresh, memory_order_acq_rel, memory_order_acquire
+        )) {
+            slots = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+    return slots != NULL ? &slots[fd % TPOOL_REACTOR_CHUNK] : NULL;
+}
+
+int tpool_reactor_add_waiter(tpool_reactor *reactor, int fd, int dir, void *waiter) {
+    tpool_io_slot *slot = slot_of(reactor, fd, true);
+    if (slot == NULL) {
+        errno = fd < 0 ? EBADF : ENOMEM;
+        return -1;
+    }
+    // Registering every time is cheap next to parking, and picks up fds
+    // that were closed and reused, which epoll drops on its own.
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+        .data.u64 = (uint64_t) fd
+    };
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event) && errno != EEXIST) {
+        return -1;
+    }
+    _Atomic uintptr_t *state = &slot->waiters[dir];
+    uintptr_t expected = SLOT_EMPTY;
+    if (atomic_compare_exchange_strong_explicit(
+        state, &expected, (uintptr_t) waiter, memory_order_acq_rel, memory_order_acquire
+    )) {
+        return 1;
+    }
+    if (expected == SLOT_READY) {
+        atomic_store_explicit(state, SLOT_EMPTY, memory_order_relaxed);
+        return 0;
+    }
+    errno = EBUSY;
+    return -1;
+}
+
+static size_t set_ready(_Atomic uintptr_t *state, void (*ready)(void *, void *), void *arg) {
+    uintptr_t old = atomic_load_explicit(state, memory_order_acquire);
+    for (;;) {
+        uintptr_t new = old > SLOT_READY ? SLOT_EMPTY : SLOT_READY;
+        if (atomic_compare_exchange_weak_explicit(
+            state, &old, new, memory_order_acq_rel, memory_order_acquire
+        )) {
+            break;
+        }
+    }
+    if (old > SLOT_READY) {
+        ready((void *) old, arg);
+        return 1;
+    }
+    return 0;
+}
+
+size_t tpool_reactor_poll(
+    tpool_reactor *reactor, int64_t timeout_ns, void (*ready)(void *waiter, void *arg), void *arg
+) {
+    struct epoll_event events[TPOOL_REACTOR_EVENTS];
+    // round up so that timers are never early
+    int timeout_ms = timeout_ns < 0 ? -1 : (int) ((timeout_ns + 999999) / 1000000);
+    int count = epoll_wait(reactor->epoll_fd, events, TPOOL_REACTOR_EVENTS, timeout_ms);
+    size_t woken = 0;
+    for (int i = 0; i < count; i++) {
+        if (events[i].data.u64 == INTERRUPT_KEY) {
+            uint64_t value;
+            while (read(reactor->event_fd, &value, sizeof(value)) > 0) {}
+            continue;
+        }
+        tpool_io_slot *slot = slot_of(reactor, (int) events[i].data.u64, false);
+        if (slot == NULL) {
+            continue;
+        }
+        uint32_t flags = events[i].events;
+        if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            woken += set_ready(&slot->waiters[TPOOL_IO_READ], ready, arg);
+        }
+        if (flags & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+            woken += set_ready(&slot->waiters[TPOOL_IO_WRITE], ready, arg);
+        }
+    }
+    return woken;
+}
+
+void tpool_reactor_interrupt(tpool_reactor *reactor) {
+    uint64_t value = 1;
+    if (write(reactor->event_fd, &value, sizeof(value)) < 0) {
+        // already pending
+    }
+}
+
+#else
+
+tpool_reactor *tpool_reactor_init(void) {
+    return NULL;
+}
+
+void tpool_reactor_free(tpool_reactor *reactor) {
+    (void) reactor;
+}
+
+int tpool_reactor_add_waiter(tpool_reactor *reactor, int fd, int dir, void *waiter) {
+    (void) reactor, (void) fd, (void) dir, (void) waiter;
+    errno = ENOSYS;
+    return -1;
+}
+
+size_t tpool_reactor_poll(
+    tpool_reactor *reactor, int64_t timeout_ns, void (*ready)(void *waiter, void *arg), void *arg
+) {
+    (void) reactor, (void) timeout_ns, (void) ready, (void) arg;
+    return 0;
+}
+
+void tpool_reactor_interrupt(tpool_reactor *reactor) {
+    (void) reactor;
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef TPOOL_REACTOR_H
+#define TPOOL_REACTOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+enum {TPOOL_IO_READ, TPOOL_IO_WRITE};
+
+/**
+ * Readiness notifications for file descriptors, backed by edge-triggered
+ * epoll. Each fd has one waiter slot per direction holding either nothing, a
+ * readiness event that nobody consumed yet, or the waiter to hand to the
+ * ready callback of tpool_reactor_poll.
+ *
+ * Only available on Linux; tpool_reactor_init returns NULL elsewhere.
+ */
+typedef struct tpool_reactor tpool_reactor;
+
+tpool_reactor *tpool_reactor_init(void);
+
+void tpool_reactor_free(tpool_reactor *reactor);
+
+/**
+ * Registers waiter for the next time fd becomes ready in direction dir.
+ *
+ * Returns 1 if waiter was registered, 0 if fd became ready since the last
+ * call and the caller should retry its operation instead, or -1 with errno
+ * set if fd cannot be polled or already has a waiter in that direction.
+ */
+int tpool_reactor_add_waiter(tpool_reactor *reactor, int fd, int dir, void *waiter);
+
+/**
+ * Waits up to timeout_ns for events, or indefinitely if negative, and
+ * passes every waiter whose fd became ready to ready. Returns early when
+ * interrupted.
+ *
+ * Returns the number of waiters passed to ready.
+ */
+size_t tpool_reactor_poll(
+    tpool_reactor *reactor, int64_t timeout_ns, void (*ready)(void *waiter, void *arg), void *arg
+);
+
+/**
+ * Makes a current or the next call to tpool_reactor_poll return.
+ */
+void tpool_reactor_interrupt(tpool_reactor *reactor);
+
+#endif
@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "ring.h"
+
+static tpool_ring_cell *cell_at(tpool_ring *ring, size_t pos) {
+    return &ring->cells[pos % ring->capacity];
+}
+
+/*
+ * The sequence number a cell holds while it waits for the push at pos, and
+ * once that item may be popped. Counting in steps of two keeps the two apart
+ * from the next lap's free value even when the ring has a single cell.
+ */
+static size_t free_seq(size_t pos) {
+    return pos * 2;
+}
+
+static size_t full_seq(size_t pos) {
+    return pos * 2 + 1;
+}
+
+// sequence numbers wrap around, so they are compared by their difference
+static intptr_t seq_diff(tpool_ring_cell *cell, size_t seq, memory_order order) {
+    return (intptr_t) (atomic_load_explicit(&cell->seq, order) - seq);
+}
+
+bool tpool_ring_init(tpool_ring *ring, size_t capacity) {
+    ring->cells = malloc(capacity * sizeof(tpool_ring_cell));
+    if (ring->cells == NULL) {
+        return false;
+    }
+    ring->capacity = capacity;
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&ring->cells[i].seq, free_seq(i));
+        ring->cells[i].item = NULL;
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return true;
+}
+
+void tpool_ring_free(tpool_ring *ring) {
+    free(ring->cells);
+    ring->cells = NULL;
+}
+
+bool tpool_ring_push(tpool_ring *ring, void *item) {
+    size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    for (;;) {
+        tpool_ring_cell *cell = cell_at(ring, pos);
+        intptr_t diff = seq_diff(cell, free_seq(pos), memory_order_acquire);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                &ring->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed
+            )) {
+                cell->item = item;
+                atomic_store_explicit(&cell->seq, full_seq(pos), memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // the item from the previous lap is still there
+            return false;
+        } else {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+}
+
+bool tpool_ring_pop(tpool_ring *ring, void **item) {
+    size_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (;;) {
+        tpool_ring_cell *cell = cell_at(ring, pos);
+        intptr_t diff = seq_diff(cell, full_seq(pos), memory_order_acquire);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                &ring->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed
+            )) {
+                *item = cell->item;
+                atomic_store_explicit(&cell->seq, free_seq(pos + ring->capacity), memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+}
+
+size_t tpool_ring_pop_many(tpool_ring *ring, void **items, size_t max) {
+    size_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (;;) {
+        // count the run of filled cells from pos, which nobody else can
+        // claim without moving head past pos
+        size_t n = 0;
+        while (n < max && seq_diff(cell_at(ring, pos + n), full_seq(pos + n), memory_order_acquire) == 0) {
+            n++;
+        }
+        if (n == 0) {
+            if (seq_diff(cell_at(ring, pos), full_seq(pos), memory_order_relaxed) < 0) {
+                return 0;
+            }
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(
+            &ring->head, &pos, pos + n, memory_order_relaxed, memory_order_relaxed
+        )) {
+            for (size_t i = 0; i < n; i++) {
+                tpool_ring_cell *cell = cell_at(ring, pos + i);
+                items[i] = cell->item;
+                atomic_store_explicit(&cell->seq, free_seq(pos + i + ring->capacity), memory_order_release);
+            }
+            return n;
+        }
+    }
+}
+
+bool tpool_ring_full(tpool_ring *ring) {
+    size_t pos = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    for (;;) {
+        intptr_t diff = seq_diff(cell_at(ring, pos), free_seq(pos), memory_order_acquire);
+        if (diff <= 0) {
+            return diff < 0;
+        }
+        pos = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    }
+}
+
+bool tpool_ring_empty(tpool_ring *ring) {
+    size_t pos = atomic_load_explicit(&ring->head, memory_order_acquire);
+    for (;;) {
+        intptr_t diff = seq_diff(cell_at(ring, pos), full_seq(pos), memory_order_acquire);
+        if (diff <= 0) {
+            return diff < 0;
+        }
+        pos = atomic_load_explicit(&ring->head, memory_order_acquire);
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef TPOOL_RING_H
+#define TPOOL_RING_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+typedef struct tpool_ring_cell {
+    // whose turn the cell is: the push or the pop at which position
+    _Atomic size_t seq;
+    void *item;
+} tpool_ring_cell;
+
+/**
+ * Bounded multi-producer multi-consumer ring of pointers (Vyukov).
+ *
+ * Producers and consumers each claim a position with a single CAS, and the
+ * sequence number of its cell tells them whether the cell is theirs yet, so
+ * neither side takes a lock or touches the other's index.
+ */
+typedef struct tpool_ring {
+    _Alignas(64) _Atomic size_t head;
+    _Alignas(64) _Atomic size_t tail;
+    size_t capacity;
+    tpool_ring_cell *cells;
+} tpool_ring;
+
+/**
+ * Returns false if the cells cannot be allocated.
+ */
+bool tpool_ring_init(tpool_ring *ring, size_t capacity);
+
+void tpool_ring_free(tpool_ring *ring);
+
+/**
+ * Adds item. Returns false if the ring is full.
+ */
+bool tpool_ring_push(tpool_ring *ring, void *item);
+
+/**
+ * Removes the oldest item into item. Returns false if the ring is empty.
+ */
+bool tpool_ring_pop(tpool_ring *ring, void **item);
+
+/**
+ * Removes up to max of the oldest items with a single claim. Returns the
+ * number removed, 0 if the ring is empty.
+ */
+size_t tpool_ring_pop_many(tpool_ring *ring, void **items, size_t max);
+
+/**
+ * Whether a push would fail at the moment. A push in progress counts as
+ * taking up its cell until it completes.
+ */
+bool tpool_ring_full(tpool_ring *ring);
+
+/**
+ * Whether a pop would fail at the moment. A push in progress only counts
+ * once it completes.
+ */
+bool tpool_ring_empty(tpool_ring *ring);
+
+#endif
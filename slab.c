@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "slab.h"
+#include "topology.h"
+
+#define TPOOL_SLAB_CHUNK_SIZE ((size_t) 64 * 1024)
+#define TPOOL_SLAB_ALIGN 64
+
+struct tpool_slab_chunk {
+    _Alignas(TPOOL_SLAB_ALIGN) tpool_slab *owner;
+    size_t class;
+    tpool_slab_chunk *next;
+};
+
+static size_t class_size(size_t class) {
+    return (size_t) TPOOL_SLAB_MIN_SIZE << class;
+}
+
+static tpool_slab_chunk *chunk_of(void *ptr) {
+    return (tpool_slab_chunk *) ((uintptr_t) ptr & ~(uintptr_t) (TPOOL_SLAB_CHUNK_SIZE - 1));
+}
+
+static void *list_pop(void **list) {
+    void *item = *list;
+    if (item != NULL) {
+        *list = *(void **) item;
+    }
+    return item;
+}
+
+void tpool_slab_init(tpool_slab *slab, int node) {
+    for (size_t i = 0; i < TPOOL_SLAB_CLASSES; i++) {
+        slab->classes[i].free = NULL;
+        atomic_init(&slab->classes[i].remote, NULL);
+        slab->classes[i].bump = NULL;
+        slab->classes[i].end = NULL;
+    }
+    slab->chunks = NULL;
+    slab->node = node;
+}
+
+void tpool_slab_destroy(tpool_slab *slab) {
+    while (slab->chunks != NULL) {
+        tpool_slab_chunk *chunk = slab->chunks;
+        slab->chunks = chunk->next;
+        free(chunk);
+    }
+    tpool_slab_init(slab, slab->node);
+}
+
+static bool add_chunk(tpool_slab *slab, size_t class) {
+    tpool_slab_chunk *chunk;
+    if (posix_memalign((void **) &chunk, TPOOL_SLAB_CHUNK_SIZE, TPOOL_SLAB_CHUNK_SIZE)) {
+        return false;
+    }
+    tpool_topology_bind(chunk, TPOOL_SLAB_CHUNK_SIZE, slab->node);
+    chunk->owner = slab;
+    chunk->class = class;
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+    slab->classes[class].bump = (char *) chunk + sizeof(tpool_slab_chunk);
+    slab->classes[class].end = (char *) chunk + TPOOL_SLAB_CHUNK_SIZE;
+    return true;
+}
+
+void *tpool_slab_alloc(tpool_slab *slab, size_t size) {
+    size_t class = 0;
+    while (class < TPOOL_SLAB_CLASSES && class_size(class) < size) {
+        class++;
+    }
+    if (class == TPOOL_SLAB_CLASSES) {
+        return NULL;
+    }
+    tpool_slab_class *cls = &slab->classes[class];
+
+    void *item = list_pop(&cls->free);
+    if (item != NULL) {
+        return item;
+    }
+    if (atomic_load_explicit(&cls->remote, memory_order_relaxed) != NULL) {
+        cls->free = atomic_exchange_explicit(&cls->remote, NULL, memory_order_acquire);
+        return list_pop(&cls->free);
+    }
+    if ((size_t) (cls->end - cls->bump) < class_size(class) && !add_chunk(slab, class)) {
+        return NULL;
+    }
+    item = cls->bump;
+    cls->bump += class_size(class);
+    return item;
+}
+
+void tpool_slab_free(tpool_slab *self, void *ptr) {
+    tpool_slab_chunk *chunk = chunk_of(ptr);
+    tpool_slab_class *cls = &chunk->owner->classes[chunk->class];
+    if (chunk->owner == self) {
+        *(void **) ptr = cls->free;
+        cls->free = ptr;
+        return;
+    }
+    void *head = atomic_load_explicit(&cls->remote, memory_order_relaxed);
+    do {
+        *(void **) ptr = head;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &cls->remote, &head, ptr, memory_order_release, memory_order_relaxed
+    ));
+}
@@ -0,0 +1,55 @@
+#ifndef TPOOL_SLAB_H
+#define TPOOL_SLAB_H
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#define TPOOL_SLAB_CLASSES 5
+#define TPOOL_SLAB_MIN_SIZE 128
+#define TPOOL_SLAB_MAX_SIZE (TPOOL_SLAB_MIN_SIZE << (TPOOL_SLAB_CLASSES - 1))
+
+typedef struct tpool_slab_chunk tpool_slab_chunk;
+
+typedef struct tpool_slab_class {
+    // objects freed by the owner
+    void *free;
+    // objects freed by other threads, reclaimed by the owner all at once
+    _Atomic(void *) remote;
+    // unused tail of the newest chunk
+    char *bump;
+    char *end;
+} tpool_slab_class;
+
+/**
+ * Cache of cache-line-aligned objects in power of two size classes, carved
+ * out of aligned chunks which are kept until the slab is destroyed.
+ *
+ * Only the owner allocates from a slab. Any thread may free into it.
+ */
+typedef struct tpool_slab {
+    tpool_slab_class classes[TPOOL_SLAB_CLASSES];
+    tpool_slab_chunk *chunks;
+    // NUMA node new chunks are placed on, or -1 for any
+    int node;
+} tpool_slab;
+
+void tpool_slab_init(tpool_slab *slab, int node);
+
+/**
+ * Frees every chunk of slab, including objects still in use.
+ */
+void tpool_slab_destroy(tpool_slab *slab);
+
+/**
+ * Allocates an object of at least size bytes. Owner only.
+ * Returns NULL if size exceeds TPOOL_SLAB_MAX_SIZE or allocation fails.
+ */
+void *tpool_slab_alloc(tpool_slab *slab, size_t size);
+
+/**
+ * Returns ptr to the slab it was allocated from. self is the caller's own
+ * slab, or NULL if it has none.
+ */
+void tpool_slab_free(tpool_slab *self, void *ptr);
+
+#endif
@@ -0,0 +1,197 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "stack.h"
+#include "topology.h"
+
+#define STACK_PAINT 0xa5
+#define STACK_PAINT_WORD 0xa5a5a5a5a5a5a5a5ull
+
+static size_t page_size() {
+    static size_t size = 0;
+    if (size == 0) {
+        size = (size_t) sysconf(_SC_PAGESIZE);
+    }
+    return size;
+}
+
+static size_t round_to_page(size_t size) {
+    size_t page = page_size();
+    return (size + page - 1) / page * page;
+}
+
+// counters have a single writer, so a plain load and store is enough
+static void counter_add(_Atomic size_t *counter, size_t delta) {
+    atomic_store_explicit(counter,
+        atomic_load_explicit(counter, memory_order_relaxed) + delta, memory_order_relaxed);
+}
+
+static tpool_stack *stack_map(size_t stack_size, int node) {
+    size_t page = page_size();
+    // one guard page below the stack, the header in its own page on top
+    size_t map_size = page + stack_size + round_to_page(sizeof(tpool_stack));
+    void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    if (mprotect(map, page, PROT_NONE)) {
+        munmap(map, map_size);
+        return NULL;
+    }
+    tpool_topology_bind((char *) map + page, map_size - page, node);
+    tpool_stack *stack = (tpool_stack *) ((char *) map + page + stack_size);
+    stack->base = (char *) map + page;
+    stack->size = stack_size;
+    stack->map_size = map_size;
+    stack->painted = stack->base;
+    stack->next = NULL;
+    stack->prev = NULL;
+    return stack;
+}
+
+static void stack_unmap(tpool_stack *stack) {
+    munmap((char *) stack->base - page_size(), stack->map_size);
+}
+
+void tpool_stack_cache_init(
+    tpool_stack_cache *cache, size_t stack_size, size_t high_water, int node, _Atomic size_t *resident_bytes
+) {
+    cache->free = NULL;
+    cache->oldest = NULL;
+    cache->count = 0;
+    cache->trimmed = NULL;
+    cache->trimmed_count = 0;
+    cache->stack_size = round_to_page(stack_size);
+    cache->high_water = high_water;
+    cache->node = node;
+    atomic_init(&cache->hits, 0);
+    atomic_init(&cache->misses, 0);
+    cache->resident_bytes = resident_bytes;
+}
+
+static void unmap_list(tpool_stack *stack) {
+    while (stack != NULL) {
+        tpool_stack *next = stack->next;
+        stack_unmap(stack);
+        stack = next;
+    }
+}
+
+void tpool_stack_cache_free(tpool_stack_cache *cache) {
+    atomic_fetch_sub_explicit(cache->resident_bytes, cache->count * cache->stack_size, memory_order_relaxed);
+    unmap_list(cache->free);
+    unmap_list(cache->trimmed);
+    cache->free = NULL;
+    cache->oldest = NULL;
+    cache->count = 0;
+    cache->trimmed = NULL;
+    cache->trimmed_count = 0;
+}
+
+tpool_stack *tpool_stack_alloc(tpool_stack_cache *cache) {
+    tpool_stack *stack = cache->free;
+    if (stack != NULL) {
+        cache->free = stack->next;
+        if (cache->free != NULL) {
+            cache->free->prev = NULL;
+        } else {
+            cache->oldest = NULL;
+        }
+        cache->count--;
+        counter_add(&cache->hits, 1);
+    } else if ((stack = cache->trimmed) != NULL) {
+        // faults its pages back in as it is used
+        cache->trimmed = stack->next;
+        cache->trimmed_count--;
+        counter_add(&cache->hits, 1);
+        atomic_fetch_add_explicit(cache->resident_bytes, stack->size, memory_order_relaxed);
+    } else {
+        counter_add(&cache->misses, 1);
+        stack = stack_map(cache->stack_size, cache->node);
+        if (stack == NULL) {
+            return NULL;
+        }
+        atomic_fetch_add_explicit(cache->resident_bytes, stack->size, memory_order_relaxed);
+    }
+    stack->next = NULL;
+    return stack;
+}
+
+/*
+ * Trims the least recently released resident stack, which is the last to be
+ * reused, or unmaps it once enough trimmed ones are kept.
+ */
+static void trim_oldest(tpool_stack_cache *cache) {
+    tpool_stack *stack = cache->oldest;
+    cache->oldest = stack->prev;
+    if (cache->oldest != NULL) {
+        cache->oldest->next = NULL;
+    } else {
+        cache->free = NULL;
+    }
+    cache->count--;
+    atomic_fetch_sub_explicit(cache->resident_bytes, stack->size, memory_order_relaxed);
+    if (cache->trimmed_count >= cache->high_water) {
+        stack_unmap(stack);
+        return;
+    }
+    // keep the mapping but let the kernel reclaim the pages
+    madvise(stack->base, stack->size, MADV_DONTNEED);
+    stack->painted = stack->base;
+    stack->next = cache->trimmed;
+    cache->trimmed = stack;
+    cache->trimmed_count++;
+}
+
+void tpool_stack_release(tpool_stack_cache *cache, tpool_stack *stack) {
+    assert(stack->size == cache->stack_size && "Stack released into the wrong cache");
+    // the most recently used stack is the most likely to still be in cache
+    stack->prev = NULL;
+    stack->next = cache->free;
+    if (cache->free != NULL) {
+        cache->free->prev = stack;
+    } else {
+        cache->oldest = stack;
+    }
+    cache->free = stack;
+    cache->count++;
+    if (cache->count > cache->high_water) {
+        trim_oldest(cache);
+    }
+}
+
+void tpool_stack_paint(tpool_stack *stack, void *limit) {
+    char *end = (char *) ((uintptr_t) limit & ~(uintptr_t) (sizeof(uint64_t) - 1));
+    if (end > stack->painted) {
+        memset(stack->painted, STACK_PAINT, end - stack->painted);
+        stack->painted = end;
+    }
+}
+
+size_t tpool_stack_measure(tpool_stack *stack, void *top) {
+    // base is page aligned and painted word aligned
+    uint64_t *word = stack->base;
+    while ((char *) word < stack->painted && *word == STACK_PAINT_WORD) {
+        word++;
+    }
+    unsigned char *low = (unsigned char *) word;
+    if ((char *) low < stack->painted) {
+        // the paint left at the bottom of the first overwritten word is unused
+        while (*low == STACK_PAINT) {
+            low++;
+        }
+    }
+    stack->painted = (char *) word;
+    return (char *) top > (char *) low ? (size_t) ((char *) top - (char *) low) : 0;
+}
+
+void tpool_stack_cache_stats(tpool_stack_cache *cache, tpool_stack_stats *stats) {
+    stats->hits += atomic_load_explicit(&cache->hits, memory_order_relaxed);
+    stats->misses += atomic_load_explicit(&cache->misses, memory_order_relaxed);
+}
@@ -0,0 +1,100 @@
+#ifndef TPOOL_STACK_H
+#define TPOOL_STACK_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/**
+ * A task stack. The mapping is laid out as
+ * [guard page][usable stack ... ][tpool_stack]
+ * so that the stack grows down from the header towards the guard page and an
+ * overflow faults instead of corrupting memory.
+ */
+typedef struct tpool_stack {
+    void *base;
+    size_t size;
+    size_t map_size;
+    // the bytes from base up to painted hold the paint pattern, while
+    // profiling
+    char *painted;
+    struct tpool_stack *next;
+    struct tpool_stack *prev;
+} tpool_stack;
+
+typedef struct tpool_stack_stats {
+    size_t hits;
+    size_t misses;
+    size_t resident_bytes;
+} tpool_stack_stats;
+
+/**
+ * Per-worker cache of recycled stacks. Only the owning worker allocates from
+ * or frees into a cache; the counters may be read from any thread.
+ */
+typedef struct tpool_stack_cache {
+    // resident stacks, most recently released first, and the least recent
+    tpool_stack *free;
+    tpool_stack *oldest;
+    size_t count;
+    // stacks whose memory was given back, reused once no resident one is left
+    tpool_stack *trimmed;
+    size_t trimmed_count;
+    size_t stack_size;
+    size_t high_water;
+    // NUMA node new stacks are placed on, or -1 for any
+    int node;
+    _Atomic size_t hits;
+    _Atomic size_t misses;
+    // shared by the caches stacks move between, so that a stack mapped by
+    // one cache and trimmed by another is accounted for once
+    _Atomic size_t *resident_bytes;
+} tpool_stack_cache;
+
+/**
+ * Initializes cache for stacks of stack_size usable bytes (rounded up to
+ * whole pages). The cache keeps up to high_water stacks resident. Beyond
+ * that, the least recently released ones have their memory given back to
+ * the kernel with MADV_DONTNEED but stay mapped for reuse, up to high_water
+ * more, and further ones are unmapped. New stacks are placed on NUMA node
+ * node, unless it is -1. The bytes of stack memory that may be resident are
+ * counted in resident_bytes.
+ */
+void tpool_stack_cache_init(
+    tpool_stack_cache *cache, size_t stack_size, size_t high_water, int node, _Atomic size_t *resident_bytes
+);
+
+/**
+ * Unmaps every cached stack.
+ */
+void tpool_stack_cache_free(tpool_stack_cache *cache);
+
+/**
+ * Gets a stack from the cache, mapping a new one on a miss.
+ * Returns NULL if the mapping fails.
+ */
+tpool_stack *tpool_stack_alloc(tpool_stack_cache *cache);
+
+/**
+ * Returns a stack to the cache.
+ */
+void tpool_stack_release(tpool_stack_cache *cache, tpool_stack *stack);
+
+/**
+ * Paints the bytes of stack below limit that are not painted yet, to later
+ * measure how deep the stack was used with tpool_stack_measure.
+ */
+void tpool_stack_paint(tpool_stack *stack, void *limit);
+
+/**
+ * Returns the bytes of stack used below top since it was last painted, by
+ * finding the lowest byte the paint was overwritten at.
+ */
+size_t tpool_stack_measure(tpool_stack *stack, void *top);
+
+/**
+ * Adds the hit and miss counters of cache to stats.
+ */
+void tpool_stack_cache_stats(tpool_stack_cache *cache, tpool_stack_stats *stats);
+
+#endif
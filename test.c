@@ -1,7 +1,19 @@
 #include <stdio.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
 
 #include "async.h"
 
+#define CHECK(COND) do {\
+    if (!(COND)) {\
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND);\
+        exit(1);\
+    }\
+} while (0)
+
 async(intptr_t, prod, intptr_t, n1, intptr_t, n2) {
     return n1 * n2;
 }
@@ -19,11 +31,706 @@ async(void *, malloc_100) {
     return malloc(100);
 }
 
+#define PIPE_BYTES (1 << 20)
+#define PIPE_CHUNK 4096
+
+// more than the pipe buffer holds, so the writer waits for room and the
+// reader for data
+async(intptr_t, pipe_writer, int, fd) {
+    char chunk[PIPE_CHUNK];
+    for (size_t sent = 0; sent < PIPE_BYTES;) {
+        size_t size = PIPE_BYTES - sent < PIPE_CHUNK ? PIPE_BYTES - sent : PIPE_CHUNK;
+        // after a short write, the next chunk starts where it stopped
+        for (size_t i = 0; i < size; i++) {
+            chunk[i] = (char) (sent + i);
+        }
+        ssize_t n = async_write(fd, chunk, size);
+        if (n <= 0) {
+            return -1;
+        }
+        sent += (size_t) n;
+    }
+    close(fd);
+    return 0;
+}
+
+async(intptr_t, pipe_reader, int, fd) {
+    char chunk[PIPE_CHUNK];
+    size_t received = 0;
+    ssize_t n;
+    while ((n = async_read(fd, chunk, PIPE_CHUNK)) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (chunk[i] != (char) (received + i)) {
+                return -1;
+            }
+        }
+        received += (size_t) n;
+    }
+    close(fd);
+    return n == 0 ? (intptr_t) received : -1;
+}
+
+static void test_pipe_io() {
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    CHECK(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+    CHECK(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+    async_handle *reader = pipe_reader(fds[0]);
+    async_handle *writer = pipe_writer(fds[1]);
+    CHECK(await(intptr_t, writer) == 0);
+    CHECK(await(intptr_t, reader) == PIPE_BYTES);
+}
+
+#define MS 1000000ull
+
+async(uint64_t, sleeper, uint64_t, ns) {
+    uint64_t start = async_now();
+    async_sleep(ns);
+    return async_now() - start;
+}
+
+static void test_timers() {
+    CHECK(await(uint64_t, sleeper(5 * MS)) >= 5 * MS);
+    // outside of the pool the thread itself sleeps
+    uint64_t start = async_now();
+    async_sleep(MS);
+    CHECK(async_now() - start >= MS);
+
+    async_handle *slow = sleeper(200 * MS);
+    void *result;
+    start = async_now();
+    CHECK(!async_await_timeout(slow, 10 * MS, &result));
+    CHECK(async_now() - start >= 10 * MS);
+    // the handle stays valid after a timeout
+    CHECK(async_await_timeout(slow, 10000 * MS, &result));
+    CHECK((uint64_t) (uintptr_t) result >= 200 * MS);
+
+    CHECK(async_await_until(sleeper(0), async_deadline(10000 * MS), &result));
+}
+
+#define GROUP_SIZE 64
+
+async(intptr_t, delayed_value, intptr_t, value, uint64_t, ns) {
+    async_sleep(ns);
+    return value;
+}
+
+static void test_await_group() {
+    async_handle *handles[GROUP_SIZE];
+    void *results[GROUP_SIZE];
+    for (intptr_t i = 0; i < GROUP_SIZE; i++) {
+        handles[i] = prod(i, i);
+    }
+    async_await_all(handles, GROUP_SIZE, results);
+    for (intptr_t i = 0; i < GROUP_SIZE; i++) {
+        CHECK((intptr_t) results[i] == i * i);
+    }
+
+    // only the quickest task is consumed
+    handles[0] = delayed_value(0, 200 * MS);
+    handles[1] = delayed_value(1, 0);
+    handles[2] = delayed_value(2, 200 * MS);
+    size_t index = 0;
+    CHECK((intptr_t) async_await_any(handles, 3, &index) == 1);
+    CHECK(index == 1);
+    // the others remain to be awaited, here returning 0 and 2
+    handles[1] = handles[2];
+    CHECK((intptr_t) async_await_any(handles, 2, &index) == (intptr_t) index * 2);
+    CHECK((intptr_t) async_await(handles[!index]) == (intptr_t) !index * 2);
+}
+
+static void *square(void *arg) {
+    intptr_t n = (intptr_t) arg;
+    return (void *) (n * n);
+}
+
+#define RANGE_END 1000
+
+static _Atomic int visits[RANGE_END];
+
+static void visit(size_t begin, size_t end, void *arg) {
+    CHECK(arg == visits && begin < end && end <= RANGE_END);
+    for (size_t i = begin; i < end; i++) {
+        atomic_fetch_add(&visits[i], 1);
+    }
+}
+
+// every index in [begin, end) visited exactly once, and none outside it
+static void check_parallel_for(size_t begin, size_t end, size_t grain) {
+    for (size_t i = 0; i < RANGE_END; i++) {
+        atomic_store(&visits[i], 0);
+    }
+    async_parallel_for(begin, end, grain, visit, visits);
+    for (size_t i = 0; i < RANGE_END; i++) {
+        CHECK(atomic_load(&visits[i]) == (i >= begin && i < end));
+    }
+}
+
+static void test_batch() {
+    void *args[GROUP_SIZE];
+    async_handle *handles[GROUP_SIZE];
+    for (intptr_t i = 0; i < GROUP_SIZE; i++) {
+        args[i] = (void *) i;
+    }
+    async_run_batch(square, args, GROUP_SIZE, handles);
+    for (intptr_t i = 0; i < GROUP_SIZE; i++) {
+        CHECK((intptr_t) async_await(handles[i]) == i * i);
+    }
+
+    check_parallel_for(3, RANGE_END, 16);
+    check_parallel_for(0, RANGE_END, 1);
+    // smaller than one grain, and empty
+    check_parallel_for(10, 20, 64);
+    check_parallel_for(10, 10, 64);
+}
+
+#define CHANNEL_ITEMS 1000
+
+async(intptr_t, channel_producer, async_channel *, channel) {
+    for (intptr_t i = 1; i <= CHANNEL_ITEMS; i++) {
+        if (async_channel_send(channel, (void *) i)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+async(intptr_t, blocked_send, async_channel *, channel) {
+    return async_channel_send(channel, (void *) 1) == -1 && errno == EPIPE;
+}
+
+async(intptr_t, blocked_recv, async_channel *, channel) {
+    void *item;
+    return async_channel_recv(channel, &item) == -1 && errno == EPIPE;
+}
+
+static void test_channels() {
+    // far more items than fit, so the producer waits for room
+    async_channel *channel = async_channel_init(8);
+    CHECK(channel != NULL);
+    async_handle *producer = channel_producer(channel);
+    for (intptr_t i = 1; i <= CHANNEL_ITEMS; i++) {
+        void *item;
+        CHECK(async_channel_recv(channel, &item) == 0);
+        CHECK((intptr_t) item == i);
+    }
+    CHECK(await(intptr_t, producer) == 0);
+
+    void *items[16];
+    for (intptr_t i = 0; i < 8; i++) {
+        CHECK(async_channel_try_send(channel, (void *) i) == 0);
+    }
+    CHECK(async_channel_try_send(channel, NULL) == -1 && errno == EAGAIN);
+    CHECK(async_channel_recv_many(channel, items, 3) == 3);
+    CHECK(async_channel_recv_many(channel, items + 3, 16) == 5);
+    for (intptr_t i = 0; i < 8; i++) {
+        CHECK((intptr_t) items[i] == i);
+    }
+    CHECK(async_channel_try_recv(channel, items) == -1 && errno == EAGAIN);
+    CHECK(async_channel_try_send(channel, (void *) 1) == 0);
+    CHECK(async_channel_try_send(channel, (void *) 2) == 0);
+    CHECK(async_channel_try_recv_many(channel, items, 16) == 2);
+    CHECK((intptr_t) items[0] == 1 && (intptr_t) items[1] == 2);
+    CHECK(async_channel_try_recv_many(channel, items, 16) == 0);
+    async_channel_free(channel);
+
+    async_channel *empty = async_channel_init(1);
+    async_channel *full = async_channel_init(1);
+    CHECK(async_channel_send(full, (void *) 7) == 0);
+    async_handle *receiver = blocked_recv(empty);
+    async_handle *sender = blocked_send(full);
+    // give both time to block
+    async_sleep(20 * MS);
+    async_channel_close(empty);
+    async_channel_close(full);
+    CHECK(await(intptr_t, receiver));
+    CHECK(await(intptr_t, sender));
+    // items sent before the close are still received
+    CHECK(async_channel_recv_many(full, items, 16) == 1 && (intptr_t) items[0] == 7);
+    CHECK(async_channel_recv_many(full, items, 16) == 0);
+    CHECK(async_channel_send(full, NULL) == -1 && errno == EPIPE);
+    async_channel_free(empty);
+    async_channel_free(full);
+}
+
+#define LOCKERS 16
+#define LOCK_ROUNDS 100
+
+static intptr_t shared_count;
+static bool go;
+
+async(intptr_t, locker, async_mutex *, mutex) {
+    for (int i = 0; i < LOCK_ROUNDS; i++) {
+        async_mutex_lock(mutex);
+        // yielding inside the critical section invites other tasks in
+        intptr_t count = shared_count;
+        yield();
+        shared_count = count + 1;
+        async_mutex_unlock(mutex);
+    }
+    return 0;
+}
+
+async(intptr_t, lock_until, async_mutex *, mutex, async_sem *, release) {
+    async_mutex_lock(mutex);
+    async_sem_wait(release);
+    async_mutex_unlock(mutex);
+    return 0;
+}
+
+async(intptr_t, sem_taker, async_sem *, sem) {
+    async_sem_wait(sem);
+    return 1;
+}
+
+async(intptr_t, go_waiter, async_mutex *, mutex, async_cond *, cond) {
+    async_mutex_lock(mutex);
+    while (!go) {
+        async_cond_wait(cond, mutex);
+    }
+    async_mutex_unlock(mutex);
+    return 1;
+}
+
+static void test_sync() {
+    async_mutex *mutex = async_mutex_init();
+    CHECK(mutex != NULL);
+    async_handle *handles[LOCKERS];
+    for (int i = 0; i < LOCKERS; i++) {
+        handles[i] = locker(mutex);
+    }
+    async_await_all(handles, LOCKERS, NULL);
+    CHECK(shared_count == LOCKERS * LOCK_ROUNDS);
+
+    // unlocking hands the mutex to the waiting task rather than freeing it
+    async_sem *release = async_sem_init(0);
+    async_mutex_lock(mutex);
+    async_handle *waiter = lock_until(mutex, release);
+    async_sleep(20 * MS);
+    async_mutex_unlock(mutex);
+    CHECK(!async_mutex_try_lock(mutex));
+    async_sem_post(release);
+    await(intptr_t, waiter);
+    CHECK(async_mutex_try_lock(mutex));
+    async_mutex_unlock(mutex);
+    async_sem_free(release);
+
+    async_sem *sem = async_sem_init(2);
+    CHECK(sem != NULL);
+    CHECK(async_sem_try_wait(sem));
+    CHECK(async_sem_try_wait(sem));
+    CHECK(!async_sem_try_wait(sem));
+    async_handle *taker = sem_taker(sem);
+    CHECK(!async_await_timeout(taker, 20 * MS, NULL));
+    async_sem_post(sem);
+    CHECK(await(intptr_t, taker));
+    async_sem_post(sem);
+    CHECK(async_sem_try_wait(sem));
+    async_sem_free(sem);
+
+    async_cond *cond = async_cond_init();
+    CHECK(cond != NULL);
+    for (int i = 0; i < LOCKERS; i++) {
+        handles[i] = go_waiter(mutex, cond);
+    }
+    async_sleep(20 * MS);
+    async_mutex_lock(mutex);
+    go = true;
+    async_cond_broadcast(cond);
+    async_mutex_unlock(mutex);
+    void *woken[LOCKERS];
+    async_await_all(handles, LOCKERS, woken);
+    for (int i = 0; i < LOCKERS; i++) {
+        CHECK((intptr_t) woken[i] == 1);
+    }
+    async_cond_free(cond);
+    async_mutex_free(mutex);
+}
+
+typedef struct triple {
+    intptr_t a, b, c;
+} triple;
+
+async(triple, make_triple, intptr_t, n) {
+    return (triple) {n, n * 2, n * 3};
+}
+
+static void test_large_results() {
+    triple t = await(triple, make_triple(5));
+    CHECK(t.a == 5 && t.b == 10 && t.c == 15);
+    // discarding the result is fine too
+    await(triple, make_triple(6));
+
+    async_handle *handles[GROUP_SIZE];
+    triple results[GROUP_SIZE];
+    for (intptr_t i = 0; i < GROUP_SIZE; i++) {
+        handles[i] = make_triple(i);
+    }
+    async_await_all_into(handles, GROUP_SIZE, results, sizeof(triple));
+    for (intptr_t i = 0; i < GROUP_SIZE; i++) {
+        CHECK(results[i].a == i && results[i].c == i * 3);
+    }
+
+    handles[0] = make_triple(7);
+    size_t index = 1;
+    CHECK(async_await_any_into(handles, 1, &index, &t, sizeof(triple)) == &t);
+    CHECK(index == 0 && t.b == 14);
+    CHECK(async_await_timeout_into(make_triple(8), 10000 * MS, &t, sizeof(triple)));
+    CHECK(t.c == 24);
+}
+
+static void test_stats() {
+    // every task spawned so far has been awaited
+    for (int i = 0; i < 1000; i++) {
+        await(intptr_t, prod(i, i));
+        async_stats stats;
+        async_stats_snapshot(&stats);
+        CHECK(stats.total.completed == stats.total.spawned);
+    }
+}
+
+static async_executor *batch;
+
+async_on(batch, intptr_t, on_batch, intptr_t, n) {
+    CHECK(async_current_executor() == batch);
+    return n * 3;
+}
+
+static void *double_on_default(void *arg) {
+    CHECK(async_current_executor() == async_default_executor());
+    return (void *) (*(intptr_t *) arg * 2);
+}
+
+async_on(batch, intptr_t, await_default, intptr_t, n) {
+    async_attr attr = {.exec = async_default_executor(), .size = sizeof(n)};
+    return (intptr_t) async_await(async_run_attr(double_on_default, &n, attr));
+}
+
+async(intptr_t, await_batch, intptr_t, n) {
+    return await(intptr_t, on_batch(n));
+}
+
+static void test_executors() {
+    batch = async_executor_create(&(async_config) {.size = 2});
+    CHECK(batch != NULL);
+    for (intptr_t i = 0; i < GROUP_SIZE; i++) {
+        CHECK(await(intptr_t, await_batch(i)) == i * 3);
+        CHECK(await(intptr_t, await_default(i)) == i * 2);
+    }
+    async_stats stats;
+    async_stats_snapshot_on(batch, &stats);
+    CHECK(stats.total.completed == stats.total.spawned);
+    async_executor_close(batch);
+}
+
+#define LOW_TASKS 64
+#define HIGH_TASKS 8
+
+static _Atomic bool gate_held, gate_open;
+static _Atomic int run_order;
+
+// keeps the only worker busy without suspending
+static void *hold_gate(void *arg) {
+    atomic_store(&gate_held, true);
+    while (!atomic_load(&gate_open)) {
+        sched_yield();
+    }
+    return arg;
+}
+
+static void *take_turn(void *arg) {
+    (void) arg;
+    return (void *) (intptr_t) atomic_fetch_add(&run_order, 1);
+}
+
+static _Atomic bool low_ran;
+static _Atomic int high_runs;
+
+// always leaves another high priority task queued until a low one runs
+static void *busy_high(void *arg) {
+    atomic_fetch_add(&high_runs, 1);
+    if (!atomic_load(&low_ran)) {
+        async_spawn_detached_attr(busy_high, arg, (async_attr) {.prio = ASYNC_PRIO_HIGH});
+    }
+    return NULL;
+}
+
+static void *run_low(void *arg) {
+    atomic_store(&low_ran, true);
+    return arg;
+}
+
+static void test_priorities() {
+    async_executor *exec = async_executor_create(&(async_config) {.size = 1});
+    CHECK(exec != NULL);
+    async_handle *gate = async_run_on(exec, hold_gate, NULL);
+    while (!atomic_load(&gate_held)) {
+        sched_yield();
+    }
+    async_handle *low[LOW_TASKS];
+    async_handle *high[HIGH_TASKS];
+    for (int i = 0; i < LOW_TASKS; i++) {
+        low[i] = async_run_attr(take_turn, NULL, (async_attr) {.exec = exec, .prio = ASYNC_PRIO_LOW});
+    }
+    for (int i = 0; i < HIGH_TASKS; i++) {
+        high[i] = async_run_attr(take_turn, NULL, (async_attr) {.exec = exec, .prio = ASYNC_PRIO_HIGH});
+    }
+    async_lane_stats stats[ASYNC_PRIO_LEVELS];
+    async_get_lane_stats_on(exec, stats);
+    CHECK(stats[ASYNC_PRIO_LOW].depth == LOW_TASKS && stats[ASYNC_PRIO_HIGH].depth == HIGH_TASKS);
+    CHECK(stats[ASYNC_PRIO_NORMAL].depth == 0);
+    async_sleep(20 * MS);
+    atomic_store(&gate_open, true);
+    async_await(gate);
+
+    // high priority tasks go first, but for the odd low one let in by aging
+    for (int i = 0; i < HIGH_TASKS; i++) {
+        CHECK((intptr_t) async_await(high[i]) < 2 * HIGH_TASKS);
+    }
+    for (int i = 0; i < LOW_TASKS; i++) {
+        async_await(low[i]);
+    }
+    async_get_lane_stats_on(exec, stats);
+    for (int prio = 0; prio < ASYNC_PRIO_LEVELS; prio++) {
+        CHECK(stats[prio].depth == 0);
+    }
+    CHECK(stats[ASYNC_PRIO_LOW].taken >= LOW_TASKS && stats[ASYNC_PRIO_HIGH].taken >= HIGH_TASKS);
+    // the first tasks queued waited for the gate
+    CHECK(stats[ASYNC_PRIO_LOW].max_wait_ns >= 10 * MS && stats[ASYNC_PRIO_LOW].mean_wait_ns > 0);
+    CHECK(stats[ASYNC_PRIO_HIGH].max_wait_ns >= 10 * MS);
+
+    // aging runs low priority work even while high priority work never runs out
+    async_spawn_detached_attr(busy_high, NULL, (async_attr) {.exec = exec, .prio = ASYNC_PRIO_HIGH});
+    while (atomic_load(&high_runs) < 100) {
+        async_sleep(MS);
+    }
+    async_handle *aged = async_run_attr(run_low, NULL, (async_attr) {.exec = exec, .prio = ASYNC_PRIO_LOW});
+    CHECK(async_await_timeout(aged, 10000 * MS, NULL));
+    CHECK(atomic_load(&low_ran));
+    async_executor_close(exec);
+}
+
+#define BLOCKED_READERS 4
+
+static async_executor *blocking_exec;
+static int blocking_pipe[2];
+
+static void *read_byte(void *arg) {
+    (void) arg;
+    char c;
+    return (void *) (intptr_t) read(blocking_pipe[0], &c, 1);
+}
+
+async_on(blocking_exec, intptr_t, blocked_reader) {
+    return (intptr_t) async_blocking(read_byte, NULL);
+}
+
+async_on(blocking_exec, intptr_t, release_reader) {
+    return write(blocking_pipe[1], "x", 1);
+}
+
+// polls the stats of blocking_exec until check accepts them or 10 s pass
+static bool wait_for_stats(bool (*check)(async_stats *stats, size_t n), size_t n) {
+    async_stats stats;
+    for (int i = 0; i < 10000; i++) {
+        async_stats_snapshot_on(blocking_exec, &stats);
+        if (check(&stats, n)) {
+            return true;
+        }
+        async_sleep(MS);
+    }
+    return false;
+}
+
+static bool blocking_is(async_stats *stats, size_t n) {
+    return stats->blocking == n;
+}
+
+static bool workers_are(async_stats *stats, size_t n) {
+    return stats->workers == n;
+}
+
+static void test_blocking() {
+    CHECK(pipe(blocking_pipe) == 0);
+    blocking_exec = async_executor_create(&(async_config) {.size = 1, .max_size = 3, .idle_timeout_ns = 50 * MS});
+    CHECK(blocking_exec != NULL);
+
+    // the only worker blocks, so an extra one has to run the release
+    async_handle *reader = blocked_reader();
+    CHECK(wait_for_stats(blocking_is, 1));
+    void *result;
+    CHECK(async_await_timeout(release_reader(), 10000 * MS, &result) && (intptr_t) result == 1);
+    CHECK(await(intptr_t, reader) == 1);
+
+    // no more than max_size workers, even with a reader left queued
+    async_handle *readers[BLOCKED_READERS];
+    for (int i = 0; i < BLOCKED_READERS; i++) {
+        readers[i] = blocked_reader();
+    }
+    CHECK(wait_for_stats(blocking_is, 3));
+    async_sleep(20 * MS);
+    async_stats stats;
+    async_stats_snapshot_on(blocking_exec, &stats);
+    CHECK(stats.blocking == 3 && stats.workers == 3 && stats.tasks == BLOCKED_READERS);
+    CHECK(async_get_worker_stats_on(blocking_exec, NULL, 0) <= 3);
+    CHECK(write(blocking_pipe[1], "xxxx", BLOCKED_READERS) == BLOCKED_READERS);
+    for (int i = 0; i < BLOCKED_READERS; i++) {
+        CHECK(await(intptr_t, readers[i]) == 1);
+    }
+
+    // the extra workers retire once idle for idle_timeout_ns
+    CHECK(wait_for_stats(workers_are, 1));
+    async_executor_close(blocking_exec);
+    close(blocking_pipe[0]);
+    close(blocking_pipe[1]);
+}
+
+#define SMALL_STACK (64 << 10)
+#define LARGE_STACK (1 << 20)
+#define DEEP_FRAME (32 << 10)
+#define LARGE_FRAME (512 << 10)
+#define PAGE 4096
+
+// only the ends of the frame are written, which is enough for the profiler
+static void *use_deep_frame(void *arg) {
+    volatile char frame[DEEP_FRAME];
+    (void) arg;
+    frame[0] = frame[DEEP_FRAME - 1] = 1;
+    return (void *) (intptr_t) frame[0];
+}
+
+// more than the default stack holds
+static void *use_large_frame(void *arg) {
+    volatile char frame[LARGE_FRAME];
+    (void) arg;
+    frame[0] = frame[LARGE_FRAME - 1] = 1;
+    return (void *) (intptr_t) frame[0];
+}
+
+static void *use_no_frame(void *arg) {
+    return arg;
+}
+
+static async_stack_usage *find_usage(async_stack_usage *usage, size_t n, async_work work) {
+    for (size_t i = 0; i < n; i++) {
+        if (usage[i].work == work) {
+            return &usage[i];
+        }
+    }
+    return NULL;
+}
+
+static void test_stacks() {
+    async_executor *exec = async_executor_create(&(async_config) {
+        .size = 1,
+        .stack_size = 256 << 10,
+        .small_stack_size = SMALL_STACK,
+        .large_stack_size = LARGE_STACK,
+        .stack_profile = true,
+    });
+    CHECK(exec != NULL);
+    async_await(async_run_on(exec, use_deep_frame, NULL));
+
+    // a task of another class starts on a newly mapped stack of its size
+    async_stack_stats before, after;
+    async_get_stack_stats_on(exec, &before);
+    async_await(async_run_attr(use_no_frame, NULL, (async_attr) {.exec = exec, .stack = ASYNC_STACK_SMALL}));
+    async_get_stack_stats_on(exec, &after);
+    CHECK(after.misses == before.misses + 1 && after.resident_bytes - before.resident_bytes == SMALL_STACK);
+    before = after;
+    async_await(async_run_attr(use_large_frame, NULL, (async_attr) {.exec = exec, .stack = ASYNC_STACK_LARGE}));
+    async_get_stack_stats_on(exec, &after);
+    CHECK(after.misses == before.misses + 1 && after.resident_bytes - before.resident_bytes == LARGE_STACK);
+
+    async_stack_usage usage[16];
+    size_t n = async_get_stack_profile_on(exec, usage, 16);
+    async_stack_usage *deep = find_usage(usage, n, use_deep_frame);
+    async_stack_usage *large = find_usage(usage, n, use_large_frame);
+    async_stack_usage *none = find_usage(usage, n, use_no_frame);
+    CHECK(deep != NULL && deep->max_bytes >= DEEP_FRAME && deep->max_bytes <= DEEP_FRAME + PAGE);
+    CHECK(large != NULL && large->max_bytes >= LARGE_FRAME && large->max_bytes <= LARGE_FRAME + PAGE);
+    // within the floor the profiler cannot see into
+    CHECK(none != NULL && none->runs == 1 && none->max_bytes == 0);
+    async_executor_close(exec);
+}
+
+static async_executor *yield_exec;
+static int yield_pipe[2];
+static _Atomic bool yielder_running, queued_ran;
+
+async_on(yield_exec, intptr_t, run_queued) {
+    atomic_store(&queued_ran, true);
+    return write(yield_pipe[1], "x", 1);
+}
+
+// queues a task on its own worker, then blocks that worker until it ran
+async_on(yield_exec, intptr_t, queue_and_block) {
+    while (!atomic_load(&yielder_running)) {
+        sched_yield();
+    }
+    async_handle *queued = run_queued();
+    char c;
+    intptr_t got = read(yield_pipe[0], &c, 1);
+    return got + await(intptr_t, queued);
+}
+
+async_on(yield_exec, intptr_t, yield_until_ran) {
+    atomic_store(&yielder_running, true);
+    yield_until(atomic_load(&queued_ran));
+    return 0;
+}
+
+static void test_yield_steals() {
+    CHECK(pipe(yield_pipe) == 0);
+    yield_exec = async_executor_create(&(async_config) {.size = 2});
+    CHECK(yield_exec != NULL);
+    async_handle *blocker = queue_and_block();
+    // the other worker yields while the task it waits for sits on the
+    // blocked worker, so only a steal runs it
+    async_handle *yielder = yield_until_ran();
+    CHECK(async_await_timeout(yielder, 10000 * MS, NULL));
+    CHECK(await(intptr_t, blocker) == 2);
+    async_executor_close(yield_exec);
+    close(yield_pipe[0]);
+    close(yield_pipe[1]);
+}
+
+#define DETACHED_TASKS 100
+
+static _Atomic int detached_done;
+
+async_detached(finish_later, uint64_t, ns) {
+    async_sleep(ns);
+    atomic_fetch_add(&detached_done, 1);
+}
+
+// checked once async_close has returned
+static void spawn_detached() {
+    for (int i = 0; i < DETACHED_TASKS; i++) {
+        finish_later(i % 10 * MS);
+    }
+}
+
 int main() {
     async_init(0);
     printf("%ld\n", await(intptr_t, prod(10, 20)));
     printf("%ld\n", await(intptr_t, fibonacci(20)));
     printf("%p\n", await(void *, malloc_100()));
+    test_pipe_io();
+    test_timers();
+    test_await_group();
+    test_batch();
+    test_channels();
+    test_sync();
+    test_large_results();
+    test_stats();
+    test_executors();
+    test_priorities();
+    test_blocking();
+    test_stacks();
+    test_yield_steals();
+    spawn_detached();
     async_close();
+    CHECK(atomic_load(&detached_done) == DETACHED_TASKS);
     return 0;
 }
\ No newline at end of file
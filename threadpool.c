@@ -1,59 +1,336 @@
 #define _XOPEN_SOURCE
 #define _GNU_SOURCE
-#include <ucontext.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <signal.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <poll.h>
 
 #include "threadpool.h"
 #include "queue.h"
+#include "deque.h"
+#include "stack.h"
+#include "context.h"
+#include "slab.h"
+#include "futex.h"
+#include "eventcount.h"
+#include "reactor.h"
+#include "timer.h"
+#include "ring.h"
+#include "topology.h"
+#include "trace.h"
 
 typedef struct task task_t;
 
+typedef struct tpool_latch tpool_latch;
+
+/*
+ * A task or thread blocked until some event. Tasks are resumed through the
+ * scheduler, threads sleep on woken. Waiters belonging to a latch count it
+ * down instead.
+ */
+typedef struct tpool_waiter {
+    task_t *task;
+    _Atomic uint32_t woken;
+    tpool_latch *latch;
+} tpool_waiter;
+
+enum {LATCH_REGISTERING, LATCH_PARKED, LATCH_DONE};
+
+/*
+ * Wakes its waiter once count reaches zero, unless that happens while the
+ * waiter is still registering. Each handle registered with the latch holds
+ * a reference, as does the waiter.
+ */
+struct tpool_latch {
+    _Atomic size_t count;
+    _Atomic size_t refs;
+    _Atomic int state;
+    bool slab;
+    // entries registered with their handles, as opposed to found finished
+    size_t registered;
+    // the entry which brought the count to zero
+    size_t last;
+    tpool_waiter waiter;
+    tpool_waiter entries[];
+};
+
+enum {WAITING, FINISHED};
+
 struct tpool_handle {
-    enum {WAITING, FINISHED} status;
-    pthread_mutex_t mutex;
-    pthread_cond_t result_cond;
-    task_t *waiter;
+    // WAITING, FINISHED, or the tpool_waiter of the one awaiter
+    _Atomic uintptr_t state;
+    // the task producing the result, so that await can run it if unstarted
+    task_t *task;
     void *result;
 };
 
 struct task {
     enum {INITIAL, RESUME, BLOCKED} type;
+    // allocated from a slab rather than malloc
+    bool slab;
+    // claimed by whichever of a worker or the awaiter runs the task first
+    _Atomic bool started;
+    // tpool_priority, the lane the task is queued in
+    uint8_t prio;
+    // tpool_stack_class, the stacks the task may start on
+    uint8_t stack_class;
+    // spawned without a handle, so its result is dropped
+    bool detached;
+    // whether ready_tick was stamped, for the tasks sampled for wait times
+    bool timed;
+    // held by the queue entry that starts the task and by its handle
+    _Atomic int refs;
+    // when the task was last made runnable, in timer ticks, if timed
+    uint32_t ready_tick;
     void *arg;
     tpool_work work;
     tpool_handle *handle;
-    void *stack;
-    ucontext_t context;
+    tpool_pool *pool;
+    // the task this one was run inline by, further down the same stack,
+    // which suspends and resumes along with it
+    task_t *outer;
+    tpool_waiter waiter;
+    tpool_stack *stack;
+    tpool_context context;
 };
 
+/*
+ * Called with a suspending task once its context is saved. Registers the
+ * task with whatever it waits on and returns true, or returns false if the
+ * task should be resumed right away.
+ */
+typedef bool (*park_fn)(task_t *task, void *arg);
+
+/*
+ * A task, its handle and a copy of its argument share one allocation, freed
+ * once the task's queue entry and handle are both done with it.
+ */
+typedef struct task_record {
+    task_t task;
+    tpool_handle handle;
+    max_align_t args[];
+} task_record;
+
+/*
+ * Detached tasks have no handle, so their argument copy follows the task.
+ */
+typedef struct detached_record {
+    task_t task;
+    max_align_t args[];
+} detached_record;
+
+/*
+ * Queue entries for suspended tasks are tagged. Untagged entries start a
+ * task and may be stale, since the awaiter may have already run it.
+ */
+#define RESUME_ENTRY_TAG ((uintptr_t) 1)
+
+enum {WATCH_NONE, WATCH_FUTEX, WATCH_REACTOR};
+
+// a worker slot is STOPPED until its thread starts, and RETIRED once an
+// extra worker has exited but not been joined yet
+enum {WORKER_STOPPED, WORKER_RUNNING, WORKER_RETIRED};
+
+/*
+ * Runnable tasks of one priority class queued on a worker, with counters
+ * only the worker writes.
+ */
+typedef struct tpool_lane {
+    tpool_deque deque;
+    // yielded tasks, taken oldest first so they run after other local work
+    tpool_deque yields;
+    // entries pushed and taken by this worker, and the ticks the sampled
+    // entries among those taken waited for
+    _Atomic uint64_t pushed;
+    _Atomic uint64_t taken;
+    _Atomic uint64_t wait_samples;
+    _Atomic uint64_t wait_ticks;
+    _Atomic uint64_t max_wait_ticks;
+} tpool_lane;
+
+/*
+ * Scheduler counters of a worker, on cache lines of their own since they
+ * change all the time. Only the worker writes them, so that counting costs a
+ * plain add.
+ */
+typedef struct tpool_counters {
+    _Alignas(64) _Atomic uint64_t spawned;
+    _Atomic uint64_t completed;
+    _Atomic uint64_t resumed;
+    _Atomic uint64_t yielded;
+    _Atomic uint64_t parked;
+    _Atomic uint64_t steal_attempts;
+    _Atomic uint64_t steals;
+    _Atomic uint64_t idle_ns;
+    _Atomic uint64_t max_queue_depth;
+} tpool_counters;
+
+/*
+ * Deepest stack use of one task function. Written by one worker alone, so
+ * a slot is filled in before its work is published.
+ */
+typedef struct tpool_profile_slot {
+    _Atomic uintptr_t work;
+    _Atomic uint64_t runs;
+    _Atomic uint64_t max_bytes;
+} tpool_profile_slot;
+
+typedef struct tpool_worker {
+    tpool_lane lanes[TPOOL_PRIO_LEVELS];
+    tpool_counters counters;
+    // one cache per tpool_stack_class
+    tpool_stack_cache stacks[TPOOL_STACK_CLASSES];
+    tpool_slab slab;
+    pthread_t thread;
+    // the CPU the worker is pinned to and its NUMA node, both -1 if unpinned
+    int cpu;
+    int node;
+    _Atomic int state;
+    tpool_trace *trace;
+    // open addressed by work, NULL unless profiling stacks
+    tpool_profile_slot *profile;
+} tpool_worker;
+
 struct tpool_pool {
-    tpool_queue *task_queue;
+    // injectors for tasks submitted from threads outside the pool, and the
+    // entries each has received
+    tpool_queue *task_queues[TPOOL_PRIO_LEVELS];
+    _Atomic uint64_t injected[TPOOL_PRIO_LEVELS];
+    // tasks spawned from threads outside the pool
+    _Atomic uint64_t external_spawned;
 
-    size_t task_count;
+    _Atomic size_t task_count;
     pthread_mutex_t task_count_mutex;
     pthread_cond_t task_count_cond;
 
+    // idle workers sleep here once they have spun for a while
+    tpool_eventcount idle;
+    // workers looking for work, which will find anything pushed meanwhile
+    _Atomic uint32_t searching;
+    // set while a woken worker has yet to start searching, so that a burst
+    // of pushes wakes a single worker
+    _Atomic bool waking;
+    _Atomic bool closing;
+
+    // fd readiness, polled by one worker at a time while tasks wait on I/O
+    tpool_reactor *reactor;
+    _Atomic size_t io_waiting;
+    _Atomic bool polling;
+
+    // timers of sleeping tasks, advanced by whichever worker gets there first
+    tpool_timer_wheel timers;
+    pthread_mutex_t timer_mutex;
+    _Atomic size_t timer_count;
+    _Atomic uint64_t next_timer;
+
+    // One idle worker at a time watches for I/O and timers, sleeping in the
+    // reactor or on watch_epoch instead of the eventcount.
+    _Atomic bool watching;
+    _Atomic int watch_state;
+    _Atomic uint32_t watch_epoch;
+
+    // task records for tasks spawned from threads outside the pool
+    tpool_slab shared_slab;
+    pthread_mutex_t shared_slab_mutex;
+
+    // Workers in blocking regions, and the monitor thread which starts extra
+    // workers in their place while tasks are queued. It only polls while
+    // there are any, and sleeps on monitor_epoch otherwise.
+    _Atomic size_t blocking;
+    _Atomic uint32_t monitor_epoch;
+    pthread_t monitor;
+    bool monitored;
+    // extra workers exit once idle for this long
+    uint64_t idle_timeout;
+
+    // the workers started with the pool, which never exit before it closes
     size_t pool_size;
-    pthread_t threads[];
+    // slots for extra workers, initialized as first needed
+    size_t max_size;
+    _Atomic size_t slot_count;
+    // NUMA nodes the workers are pinned to, 1 if they are not
+    size_t node_count;
+    // CPUs unpinned workers are confined to, NULL for any, and the niceness
+    // of every worker
+    int *cpus;
+    size_t cpu_count;
+    int nice;
+    // configuration of the stack caches of each worker
+    size_t stack_sizes[TPOOL_STACK_CLASSES];
+    size_t stack_cache_size;
+    bool stack_profile;
+    // stack bytes that may be resident, over all workers' caches
+    _Atomic size_t stack_resident;
+    // events each worker traces, 0 unless tracing, and when tracing started
+    size_t trace_events;
+    tpool_trace_epoch trace_start;
+    tpool_worker workers[];
 };
 
 typedef struct thread_data {
     bool init;
-    ucontext_t yield_context;
-    ucontext_t return_context;
+    tpool_context native_context;
+    tpool_context sched_context;
+    // the stack currently executing on
+    tpool_stack *stack;
+    // handled by after_switch once the switch away from them has completed
+    tpool_stack *release_stack;
+    // a task the scheduler moved to a stack of its class to start
+    task_t *pending;
+    // set while finishing a task the worker launched, during which a task
+    // woken by its completion is stored in handoff to be resumed directly
+    bool completing;
+    task_t *handoff;
+    task_t *suspended;
+    park_fn park;
+    void *park_arg;
     size_t id;
     task_t *curr_task;
+    tpool_pool *pool;
+    tpool_worker *worker;
+    uint32_t rng;
+    // tasks launched, to poll for I/O and timers every so often while busy
+    uint32_t ticks;
     pthread_t self;
+    // the worker's trace, NULL unless tracing
+    tpool_trace *trace;
+    // the worker's stack profile, NULL unless profiling
+    tpool_profile_slot *profile;
 } tdata_t;
 
-#define TPOOL_DEFAULT_SIZE 16
+#define TPOOL_DEFAULT_STACK_SIZE (4096 * 16)
+#define TPOOL_DEFAULT_SMALL_STACK_SIZE (4096 * 4)
+#define TPOOL_DEFAULT_LARGE_STACK_SIZE (4096 * 256)
+#define TPOOL_DEFAULT_STACK_CACHE_SIZE 64
+// rounds of looking for work before an idle worker goes to sleep
+#define TPOOL_SPIN_COUNT 64
+// rounds of retrying a contended lock or semaphore before parking
+#define TPOOL_LOCK_SPIN_COUNT 64
+// every this many tasks, a worker looks in its lower lanes first, so that
+// they progress however busy the higher ones are
+#define TPOOL_AGING_INTERVAL 16
+// one in this many tasks a worker queues is timed, since reading the clock
+// for every task costs more than running a short one
+#define TPOOL_WAIT_SAMPLE_INTERVAL 16
+// tasks a busy worker launches between checks for ready I/O and timers
+#define TPOOL_POLL_INTERVAL 64
+// workers the monitor may start beyond the initial ones by default
+#define TPOOL_DEFAULT_EXTRA_WORKERS 64
+#define TPOOL_DEFAULT_IDLE_TIMEOUT ((uint64_t) 1000000000)
+// how often the monitor checks for queued tasks while workers are blocking
+#define TPOOL_MONITOR_INTERVAL ((uint64_t) 1000000)
+// task functions each worker keeps the stack use of, a power of two
+#define TPOOL_STACK_PROFILE_SLOTS 1024
 __thread tdata_t tdata = {.init = false};
 
-static tdata_t *get_tdata();
+static tdata_t *get_tdata() __attribute__((noinline));
 
 #define _LOG_INNER(PREFIX, FMT, ARGS...)\
     do {\
@@ -105,10 +382,21 @@ static tdata_t *get_tdata();
         }\
     } while (0)
 
+// costs a single well-predicted branch while tracing is off
+#define TRACE(TDATA, TYPE, TASK)\
+    do {\
+        if (__builtin_expect((TDATA)->trace != NULL, 0)) {\
+            tpool_trace_record((TDATA)->trace, TYPE, TASK);\
+        }\
+    } while (0)
+
 #define UNIMPLEMENTED(...) ERROR("Unimplemented.\n")
 
 #define UNREACHABLE(...) ERROR("Unreachable.\n")
 
+// Tasks migrate between threads across context switches, so the address of
+// tdata must be recomputed after every switch rather than cached by the
+// compiler; keeping this out of line guarantees that.
 static tdata_t *get_tdata() {
     if (((volatile tdata_t) tdata).init) {
         ASSERT(pthread_equal(pthread_self(), tdata.self)
@@ -119,243 +407,2657 @@ static tdata_t *get_tdata() {
     }
 }
 
-#define PAGE_SIZE 4096
-#define TASK_STACK_SIZE PAGE_SIZE * 16
+static void modify_task_count(tpool_pool *pool, int delta) {
+    if (delta > 0) {
+        atomic_fetch_add_explicit(&pool->task_count, delta, memory_order_relaxed);
+    } else if (atomic_fetch_add_explicit(&pool->task_count, delta, memory_order_acq_rel) == (size_t) -delta) {
+        pthread_mutex_lock(&pool->task_count_mutex);
+        pthread_cond_broadcast(&pool->task_count_cond);
+        pthread_mutex_unlock(&pool->task_count_mutex);
+    }
+}
 
-static void task_wrapper() {
-    tdata_t *tdata = get_tdata();
-    void *out = tdata->curr_task->work(tdata->curr_task->arg);
-    tdata = get_tdata();
-    tdata->curr_task->arg = out;
-    setcontext(&tdata->return_context);
+static void wake_watcher(tpool_pool *pool, int watch) {
+    if (watch == WATCH_REACTOR) {
+        tpool_reactor_interrupt(pool->reactor);
+    } else {
+        atomic_fetch_add(&pool->watch_epoch, 1);
+        tpool_futex_wake(&pool->watch_epoch, 1);
+    }
 }
 
 /**
- * @brief Begins or continues execution of a task. If the task contains
- * an asynchronous call, the task will be suspended and the thread will
- * return to the thread pool. If the task completes, the result will be
- * returned.
- *
- * Notably, it is possible that this function will not return at all and the
- * thread will continue execution inside work_launcher.
- *
- * If it does return, it consumes task.
- *
- * @param task
- * @return void*
+ * @brief Wakes a sleeping worker, unless a worker is already looking for
+ * work or on its way to. Must be called after work is made available.
  */
-static void *run_task(task_t *task) {
-    tdata_t *tdata = get_tdata();
-    tdata->curr_task = task;
-    if (task->type == INITIAL) {
-        DEBUG("Initializing task %p\n", task->handle);
-        getcontext(&task->context);
-        task->stack = malloc(TASK_STACK_SIZE);
-        task->context.uc_stack = (stack_t) {
-            .ss_sp = task->stack,
-            .ss_size = TASK_STACK_SIZE,
-            .ss_flags = 0
-        };
-        makecontext(&task->context, task_wrapper, 0);
-    } else if (task->type == RESUME) {
-        DEBUG("Resuming task %p\n", task->handle);
-    } else if (task->type == BLOCKED) {
-        ERROR("Attempted to run blocked task.\n");
+static void notify_worker(tpool_pool *pool) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&pool->searching, memory_order_relaxed) > 0) {
+        return;
+    }
+    bool sleeping = tpool_eventcount_has_waiters(&pool->idle);
+    int watch = sleeping ? WATCH_NONE : atomic_load_explicit(&pool->watch_state, memory_order_relaxed);
+    if ((!sleeping && watch == WATCH_NONE) || atomic_exchange(&pool->waking, true)) {
+        return;
+    }
+    if (sleeping) {
+        tpool_eventcount_notify(&pool->idle, 1);
     } else {
-        ERROR("Invalid task type.\n");
+        wake_watcher(pool, watch);
     }
-    swapcontext(&tdata->return_context, &task->context);
+}
 
-    tdata = get_tdata();
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile ("yield");
+#endif
+}
 
-    DEBUG("Returning from task %p with value %p\n", task->handle, tdata->curr_task->arg);
-    void *out = tdata->curr_task->arg;
-    free(tdata->curr_task->stack);
-    free(tdata->curr_task);
-    tdata->curr_task = NULL;
-    return out;
+/**
+ * @brief Returns the queue entry for task: tagged with RESUME_ENTRY_TAG if
+ * it is suspended and ready to resume, so that the worker taking it resumes
+ * it rather than checking whether an awaiter already started it.
+ */
+static void *task_entry(task_t *task) {
+    if (task->type == RESUME) {
+        return (void *) ((uintptr_t) task | RESUME_ENTRY_TAG);
+    }
+    return task;
 }
 
-static void modify_task_count(tpool_pool *pool, int delta) {
-    pthread_mutex_lock(&pool->task_count_mutex);
-    pool->task_count += delta;
-    pthread_cond_broadcast(&pool->task_count_cond);
-    pthread_mutex_unlock(&pool->task_count_mutex);
+/**
+ * @brief Adds n to a counter only the calling worker writes, without a
+ * locked instruction.
+ */
+static inline void counter_add(_Atomic uint64_t *counter, uint64_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
 }
 
-static bool launch_task(tpool_pool *pool) {
-    task_t *task = tpool_dequeue(pool->task_queue);
+static inline void counter_max(_Atomic uint64_t *counter, uint64_t value) {
+    if (value > atomic_load_explicit(counter, memory_order_relaxed)) {
+        atomic_store_explicit(counter, value, memory_order_relaxed);
+    }
+}
 
-    if (task == NULL) {
-        return true;
+static uint32_t ready_tick(void) {
+    return (uint32_t) (tpool_timer_now() >> TPOOL_TIMER_TICK_SHIFT);
+}
+
+static void lane_push(tpool_worker *worker, tpool_lane *lane, tpool_deque *deque, task_t *task) {
+    uint64_t pushed = atomic_load_explicit(&lane->pushed, memory_order_relaxed);
+    task->timed = pushed % TPOOL_WAIT_SAMPLE_INTERVAL == 0;
+    if (task->timed) {
+        task->ready_tick = ready_tick();
+    }
+    tpool_deque_push(deque, task_entry(task));
+    atomic_store_explicit(&lane->pushed, pushed + 1, memory_order_relaxed);
+    counter_max(&worker->counters.max_queue_depth, tpool_deque_size(deque));
+}
+
+static void schedule_task(tpool_pool *pool, task_t *task) {
+    tdata_t *tdata = get_tdata();
+    if (tdata != NULL && tdata->pool == pool) {
+        tpool_lane *lane = &tdata->worker->lanes[task->prio];
+        lane_push(tdata->worker, lane, &lane->deque, task);
+    } else {
+        // the injector lock costs more than the clock anyway
+        task->timed = true;
+        task->ready_tick = ready_tick();
+        atomic_fetch_add_explicit(&pool->injected[task->prio], 1, memory_order_relaxed);
+        tpool_enqueue(pool->task_queues[task->prio], task_entry(task));
     }
+    notify_worker(pool);
+}
+
+static void schedule_yielded(tpool_pool *pool, task_t *task) {
+    tpool_worker *worker = get_tdata()->worker;
+    tpool_lane *lane = &worker->lanes[task->prio];
+    counter_add(&worker->counters.yielded, 1);
+    lane_push(worker, lane, &lane->yields, task);
+    notify_worker(pool);
+}
 
-    tpool_handle *handle = task->handle;
-    handle->result = run_task(task); // May not return.
+static void latch_arrive(tpool_waiter *entry);
 
-    pthread_mutex_lock(&handle->mutex);
-    handle->status = FINISHED;
-    if (handle->waiter != NULL) {
-        handle->waiter->type = RESUME;
-        tpool_enqueue(pool->task_queue, handle->waiter);
-        handle->waiter = NULL;
+static void wake_waiter(tpool_waiter *waiter) {
+    if (waiter->latch != NULL) {
+        latch_arrive(waiter);
+    } else if (waiter->task != NULL) {
+        task_t *task = waiter->task;
+        task->type = RESUME;
+        tdata_t *tdata = get_tdata();
+        if (tdata != NULL && tdata->completing && tdata->handoff == NULL && tdata->pool == task->pool) {
+            tdata->handoff = task;
+        } else {
+            schedule_task(task->pool, task);
+        }
+    } else {
+        atomic_store_explicit(&waiter->woken, 1, memory_order_release);
+        tpool_futex_wake(&waiter->woken, 1);
     }
-    pthread_cond_broadcast(&handle->result_cond);
-    pthread_mutex_unlock(&handle->mutex);
-    DEBUG("Signaled handle %p\n", handle);
-    modify_task_count(pool, -1);
-    DEBUG("Finished task %p\n", handle);
-    return false;
 }
 
-static void *pool_thread(void *arg) {
-    tdata = (tdata_t) {
-        .init = true,
-        .self = pthread_self(),
-        .id = *(size_t *) (arg + sizeof(tpool_pool *)),
-        .curr_task = NULL,
-    };
-    // pthread_setspecific(thread_local_key, tdata);
+static void wait_waiter(tpool_waiter *waiter) {
+    while (!atomic_load_explicit(&waiter->woken, memory_order_acquire)) {
+        tpool_futex_wait(&waiter->woken, 0);
+    }
+}
 
-    tpool_pool *pool = *(tpool_pool **) arg;
-    free(arg);
+static bool latch_count_down(tpool_latch *latch) {
+    return atomic_fetch_sub_explicit(&latch->count, 1, memory_order_acq_rel) == 1;
+}
 
-    getcontext(&tdata.yield_context);
-    DEBUG("Passed yield context.\n");
-    if (tdata.curr_task != NULL) {
-        DEBUG("Enqueued task.\n");
-        tpool_enqueue(pool->task_queue, tdata.curr_task);
-        tdata.curr_task = NULL;
+static void latch_release(tpool_latch *latch) {
+    if (atomic_fetch_sub_explicit(&latch->refs, 1, memory_order_acq_rel) != 1) {
+        return;
     }
-    while (true) {
-        if (launch_task(pool)) {
-            return NULL;
+    if (latch->slab) {
+        tdata_t *tdata = get_tdata();
+        tpool_slab_free(tdata != NULL ? &tdata->worker->slab : NULL, latch);
+    } else {
+        free(latch);
+    }
+}
+
+static void latch_arrive(tpool_waiter *entry) {
+    tpool_latch *latch = entry->latch;
+    if (latch_count_down(latch)) {
+        latch->last = entry - latch->entries;
+        int state = LATCH_REGISTERING;
+        if (!atomic_compare_exchange_strong_explicit(
+            &latch->state, &state, LATCH_DONE, memory_order_acq_rel, memory_order_acquire
+        )) {
+            wake_waiter(&latch->waiter);
         }
     }
+    latch_release(latch);
 }
 
-tpool_pool *tpool_init(size_t size) {
-    if (size == 0) {
-        size = TPOOL_DEFAULT_SIZE;
+static void task_release(task_t *task) {
+    if (atomic_fetch_sub_explicit(&task->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    if (task->slab) {
+        tdata_t *tdata = get_tdata();
+        tpool_slab_free(tdata != NULL ? &tdata->worker->slab : NULL, task);
+    } else {
+        free(task);
     }
+}
 
-    tpool_pool *pool = malloc(sizeof(tpool_pool) + sizeof(pthread_t) * size);
+static bool lane_has_work(tpool_lane *lane) {
+    return tpool_deque_size(&lane->deque) > 0 || tpool_deque_size(&lane->yields) > 0;
+}
 
-    pool->pool_size = size;
-    pool->task_count = 0;
+static bool worker_has_work(tpool_worker *worker) {
+    for (int prio = 0; prio < TPOOL_PRIO_LEVELS; prio++) {
+        if (lane_has_work(&worker->lanes[prio])) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    ASSERT(!pthread_mutex_init(&pool->task_count_mutex, NULL));
+static bool has_injected_work(tpool_pool *pool) {
+    for (int prio = 0; prio < TPOOL_PRIO_LEVELS; prio++) {
+        if (tpool_queue_count(pool->task_queues[prio]) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool has_work(tpool_pool *pool) {
+    if (has_injected_work(pool)) {
+        return true;
+    }
+    size_t slots = atomic_load_explicit(&pool->slot_count, memory_order_acquire);
+    for (size_t i = 0; i < slots; i++) {
+        if (worker_has_work(&pool->workers[i])) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    pool->task_queue = tpool_queue_init();
+static uint32_t next_random(tdata_t *tdata) {
+    // xorshift32
+    uint32_t x = tdata->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return tdata->rng = x;
+}
 
-    // spawn the thread pool
-    size_t i;
-    for (i = 0; i < size; i++) {
-        void *thread_start_arg = malloc(sizeof(tpool_pool *) + sizeof(size_t));
-        *(tpool_pool **) thread_start_arg = pool;
-        *(size_t *) (thread_start_arg + sizeof(tpool_pool *)) = i;
-        int ret = pthread_create(&pool->threads[i], NULL, pool_thread, thread_start_arg);
-        if (ret) {
-            goto FAIL;
+/**
+ * @brief Steals an entry of class prio from another worker, trying the
+ * workers on the thief's own NUMA node before the rest.
+ */
+static void *steal_task(tpool_pool *pool, tdata_t *tdata, int prio) {
+    size_t size = atomic_load_explicit(&pool->slot_count, memory_order_acquire);
+    size_t start = next_random(tdata) % size;
+    // the first pass looks at the local node and the second at the others,
+    // unless there is only one
+    int passes = pool->node_count > 1 ? 2 : 1;
+    for (int pass = 0; pass < passes; pass++) {
+        for (size_t i = 0; i < size; i++) {
+            tpool_worker *victim = &pool->workers[(start + i) % size];
+            tpool_lane *lane = &victim->lanes[prio];
+            if (passes > 1 && (victim->node == tdata->worker->node) != (pass == 0)) {
+                continue;
+            }
+            // checked first since most lanes are empty, and a failed steal
+            // costs a fence
+            if (victim == tdata->worker || !lane_has_work(lane)) {
+                continue;
+            }
+            counter_add(&tdata->worker->counters.steal_attempts, 1);
+            void *entry = tpool_deque_steal(&lane->deque);
+            if (entry == NULL) {
+                entry = tpool_deque_steal(&lane->yields);
+            }
+            if (entry != NULL) {
+                counter_add(&tdata->worker->counters.steals, 1);
+                VERBOSE("Stole entry %p from T%02lu.\n", entry, (start + i) % size);
+                return entry;
+            }
         }
     }
-    return pool;
-    FAIL:
-    tpool_queue_free(pool->task_queue);
-    for (size_t j = 0; j < i; j++) {
-        pthread_kill(pool->threads[j], SIGKILL);
+    return NULL;
+}
+
+/**
+ * @brief The order in which to look through the lanes: strictly by
+ * priority, except every TPOOL_AGING_INTERVAL tasks, when one of the lower
+ * lanes goes first, in turn.
+ */
+static void lane_order(tdata_t *tdata, int order[TPOOL_PRIO_LEVELS]) {
+    static const int by_rank[TPOOL_PRIO_LEVELS] = {TPOOL_PRIO_HIGH, TPOOL_PRIO_NORMAL, TPOOL_PRIO_LOW};
+    int first = 0;
+    if (tdata->ticks % TPOOL_AGING_INTERVAL == 0) {
+        first = 1 + tdata->ticks / TPOOL_AGING_INTERVAL % (TPOOL_PRIO_LEVELS - 1);
+    }
+    for (int i = 0; i < TPOOL_PRIO_LEVELS; i++) {
+        order[i] = by_rank[(first + i) % TPOOL_PRIO_LEVELS];
+    }
+}
+
+/**
+ * @brief Steals an entry of any class from another worker, highest class
+ * first but for aging.
+ */
+static void *steal_any(tpool_pool *pool, tdata_t *tdata) {
+    int order[TPOOL_PRIO_LEVELS];
+    lane_order(tdata, order);
+    for (int i = 0; i < TPOOL_PRIO_LEVELS; i++) {
+        void *entry = steal_task(pool, tdata, order[i]);
+        if (entry != NULL) {
+            return entry;
+        }
     }
-    free(pool);
     return NULL;
 }
 
-void tpool_close(tpool_pool *pool) {
-    size_t size = pool->pool_size;
+static void *find_task(tpool_pool *pool, tdata_t *tdata) {
+    int order[TPOOL_PRIO_LEVELS];
+    lane_order(tdata, order);
+    for (int i = 0; i < TPOOL_PRIO_LEVELS; i++) {
+        tpool_lane *lane = &tdata->worker->lanes[order[i]];
+        void *entry = NULL;
+        if (tpool_deque_size(&lane->deque) > 0) {
+            entry = tpool_deque_pop(&lane->deque);
+        }
+        if (entry == NULL) {
+            entry = tpool_dequeue(pool->task_queues[order[i]]);
+        }
+        if (entry == NULL && tpool_deque_size(&lane->yields) > 0) {
+            entry = tpool_deque_steal(&lane->yields);
+        }
+        if (entry != NULL) {
+            return entry;
+        }
+    }
+    return steal_any(pool, tdata);
+}
 
-    // queue will return NULL instead of blocking when empty
-    pthread_mutex_lock(&pool->task_count_mutex);
-    while (pool->task_count > 0) {
-        pthread_cond_wait(&pool->task_count_cond, &pool->task_count_mutex);
+/**
+ * @brief Counts a taken entry against the lane of its task, along with how
+ * long the task waited if the entry is to run it and it was timed.
+ */
+static void lane_taken(tdata_t *tdata, task_t *task, bool run) {
+    tpool_lane *lane = &tdata->worker->lanes[task->prio];
+    counter_add(&lane->taken, 1);
+    if (run && task->timed) {
+        uint32_t wait = ready_tick() - task->ready_tick;
+        counter_add(&lane->wait_samples, 1);
+        counter_add(&lane->wait_ticks, wait);
+        if (wait > atomic_load_explicit(&lane->max_wait_ticks, memory_order_relaxed)) {
+            atomic_store_explicit(&lane->max_wait_ticks, wait, memory_order_relaxed);
+        }
     }
-    tpool_queue_unblock(pool->task_queue);
-    pthread_mutex_unlock(&pool->task_count_mutex);
+}
 
-    for (size_t i = 0; i < size; i++) {
-        pthread_join(pool->threads[i], NULL);
+static void io_ready(void *waiter, void *pool) {
+    atomic_fetch_sub_explicit(&((tpool_pool *) pool)->io_waiting, 1, memory_order_relaxed);
+    wake_waiter(waiter);
+}
+
+/**
+ * @brief Resumes tasks whose fds became ready, if no other worker is
+ * polling already. Blocks up to timeout_ns, indefinitely if negative.
+ *
+ * Returns true if any task was resumed.
+ */
+static bool poll_io(tpool_pool *pool, int64_t timeout_ns) {
+    if (pool->reactor == NULL
+        || atomic_load_explicit(&pool->io_waiting, memory_order_relaxed) == 0
+        || atomic_exchange_explicit(&pool->polling, true, memory_order_acquire)) {
+        return false;
     }
-    tpool_queue_free(pool->task_queue);
-    free(pool);
+    bool woken = tpool_reactor_poll(pool->reactor, timeout_ns, io_ready, pool) > 0;
+    atomic_store_explicit(&pool->polling, false, memory_order_release);
+    return woken;
 }
 
 /**
- * @brief Yields execution to the threadpool, enqueueing a resume task so that
- * the threadpool can resume execution of the current task eventually.
+ * @brief Publishes the timer count and next expiry. timer_mutex must be held.
+ */
+static void timers_updated(tpool_pool *pool) {
+    atomic_store_explicit(&pool->timer_count, pool->timers.count, memory_order_relaxed);
+    atomic_store(&pool->next_timer, tpool_timer_wheel_next(&pool->timers));
+}
+
+/**
+ * @brief Adds timer to the pool, waking the watcher if it now needs to wake
+ * earlier. timer_mutex must be held.
  *
- * Assumes the calling thread is a threadpool thread.
+ * Returns false if the deadline has passed.
+ */
+static bool add_timer(tpool_pool *pool, tpool_timer *timer) {
+    uint64_t next = atomic_load_explicit(&pool->next_timer, memory_order_relaxed);
+    if (!tpool_timer_add(&pool->timers, timer)) {
+        return false;
+    }
+    timers_updated(pool);
+    // pairs with the watcher publishing its state before reading next_timer
+    if (atomic_load_explicit(&pool->next_timer, memory_order_relaxed) < next) {
+        int watch = atomic_load(&pool->watch_state);
+        if (watch != WATCH_NONE) {
+            wake_watcher(pool, watch);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Fires expired timers, unless another worker is at it. Timers fire
+ * with timer_mutex held.
+ */
+static void run_timers(tpool_pool *pool) {
+    if (atomic_load_explicit(&pool->timer_count, memory_order_relaxed) == 0) {
+        return;
+    }
+    uint64_t now = tpool_timer_now();
+    if (now < atomic_load_explicit(&pool->next_timer, memory_order_relaxed)
+        || pthread_mutex_trylock(&pool->timer_mutex)) {
+        return;
+    }
+    tpool_timer_wheel_advance(&pool->timers, now);
+    timers_updated(pool);
+    pthread_mutex_unlock(&pool->timer_mutex);
+}
+
+/**
+ * @brief Sleeps as the watcher of the pool: in the reactor while tasks wait
+ * on I/O, and no longer than until the next timer, so that one idle worker
+ * is always there to resume them.
  *
- * May return in different thread than the caller, but returns exactly once.
+ * Returns false if another worker is watching, or there is nothing to watch.
  */
-void tpool_yield() {
-    tdata_t *tdata = get_tdata();
-    tdata->curr_task->type = RESUME;
-    DEBUG("Yielding task %p.\n", tdata->curr_task->handle);
-    swapcontext(&tdata->curr_task->context, &tdata->yield_context);
-    DEBUG("Resuming %p.\n", get_tdata()->curr_task->handle);
+static bool watch_idle(tpool_pool *pool, tdata_t *tdata) {
+    bool io = pool->reactor != NULL
+        && atomic_load_explicit(&pool->io_waiting, memory_order_relaxed) > 0;
+    if ((!io && atomic_load_explicit(&pool->timer_count, memory_order_relaxed) == 0)
+        || atomic_exchange_explicit(&pool->watching, true, memory_order_acquire)) {
+        return false;
+    }
+    if (io && atomic_exchange_explicit(&pool->polling, true, memory_order_acquire)) {
+        // a busy worker is polling for a moment
+        atomic_store_explicit(&pool->watching, false, memory_order_release);
+        return true;
+    }
+    uint32_t key = atomic_load(&pool->watch_epoch);
+    atomic_store(&pool->watch_state, io ? WATCH_REACTOR : WATCH_FUTEX);
+    atomic_store(&pool->waking, false);
+    atomic_fetch_sub(&pool->searching, 1);
+    uint64_t until = atomic_load(&pool->next_timer);
+    if (!has_work(pool) && !atomic_load(&pool->closing)) {
+        uint64_t now = tpool_timer_now();
+        int64_t timeout = until == UINT64_MAX ? -1 : until > now ? (int64_t) (until - now) : 0;
+        TRACE(tdata, TPOOL_TRACE_PARK, NULL);
+        if (io) {
+            tpool_reactor_poll(pool->reactor, timeout, io_ready, pool);
+        } else if (timeout != 0) {
+            struct timespec ts = {.tv_sec = timeout / 1000000000, .tv_nsec = timeout % 1000000000};
+            tpool_futex_wait_for(&pool->watch_epoch, key, timeout < 0 ? NULL : &ts);
+        }
+        TRACE(tdata, TPOOL_TRACE_UNPARK, NULL);
+    }
+    atomic_store(&pool->watch_state, WATCH_NONE);
+    if (io) {
+        atomic_store_explicit(&pool->polling, false, memory_order_release);
+    }
+    atomic_store_explicit(&pool->watching, false, memory_order_release);
+    atomic_fetch_add(&pool->searching, 1);
+    atomic_store(&pool->waking, false);
+    run_timers(pool);
+    return true;
 }
 
-void *tpool_task_await(tpool_handle *handle) {
-    DEBUG("Awaiting handle %p.\n", handle);
-    pthread_mutex_lock(&handle->mutex);
-    tdata_t *tdata = get_tdata();
-    if (tdata) {
-        task_t *task = tdata->curr_task;
-        while (handle->status == WAITING) {
-            task->type = BLOCKED;
-            ASSERT(handle->waiter == NULL);
-            handle->waiter = task;
-            tdata->curr_task = NULL;
-            pthread_mutex_unlock(&handle->mutex);
-            DEBUG("Yielding task %p.\n", task->handle);
-            swapcontext(&task->context, &tdata->yield_context); 
-            // tdata is invalidated past this point, since executation may
-            // continue in another thread.
-            DEBUG("Resuming %p.\n", get_tdata()->curr_task->handle);
-            pthread_mutex_lock(&handle->mutex);
+static void stop_searching(tpool_pool *pool) {
+    // Pushes made while a worker was searching woke nobody, so the last
+    // searcher to find work passes the search on if there is more.
+    if (atomic_fetch_sub(&pool->searching, 1) == 1 && has_work(pool)) {
+        notify_worker(pool);
+    }
+}
+
+/**
+ * @brief Spins looking for work, then sleeps until notified.
+ *
+ * Returns NULL if the pool is closing, or the worker is an extra one which
+ * has been idle for the idle timeout since idle_since, and the worker should
+ * exit.
+ */
+static void *search_for_work(tpool_pool *pool, tdata_t *tdata, uint64_t idle_since) {
+    bool extra = tdata->id >= pool->pool_size;
+    atomic_fetch_add(&pool->searching, 1);
+    for (;;) {
+        run_timers(pool);
+        poll_io(pool, 0);
+        for (int i = 0; i < TPOOL_SPIN_COUNT; i++) {
+            void *entry = find_task(pool, tdata);
+            if (entry != NULL) {
+                stop_searching(pool);
+                return entry;
+            }
+            cpu_relax();
         }
-    } else {
-        while (handle->status == WAITING) {
-            pthread_cond_wait(&handle->result_cond, &handle->mutex);
+        if (watch_idle(pool, tdata)) {
+            continue;
         }
+        uint32_t key = tpool_eventcount_prepare(&pool->idle);
+        atomic_store(&pool->waking, false);
+        atomic_fetch_sub(&pool->searching, 1);
+        if (has_work(pool)) {
+            tpool_eventcount_cancel(&pool->idle);
+        } else if (atomic_load(&pool->closing)) {
+            tpool_eventcount_cancel(&pool->idle);
+            return NULL;
+        } else if (extra) {
+            uint64_t idle = tpool_timer_now() - idle_since;
+            if (idle >= pool->idle_timeout) {
+                tpool_eventcount_cancel(&pool->idle);
+                // a notification meant for this worker is dropped, so
+                // whoever pushed since has to be noticed here
+                atomic_store(&pool->waking, false);
+                if (!has_work(pool)) {
+                    DEBUG("Retiring after %lu ns idle.\n", idle);
+                    return NULL;
+                }
+            } else {
+                uint64_t timeout = pool->idle_timeout - idle;
+                struct timespec ts = {.tv_sec = timeout / 1000000000, .tv_nsec = timeout % 1000000000};
+                TRACE(tdata, TPOOL_TRACE_PARK, NULL);
+                tpool_eventcount_wait(&pool->idle, key, &ts);
+                TRACE(tdata, TPOOL_TRACE_UNPARK, NULL);
+            }
+        } else {
+            TRACE(tdata, TPOOL_TRACE_PARK, NULL);
+            tpool_eventcount_wait(&pool->idle, key, NULL);
+            TRACE(tdata, TPOOL_TRACE_UNPARK, NULL);
+        }
+        atomic_fetch_add(&pool->searching, 1);
+        atomic_store(&pool->waking, false);
     }
-    void *result = handle->result;
-    pthread_mutex_unlock(&handle->mutex);
-    DEBUG("Done waiting on handle %p.\n", handle);
-    free(handle);
+}
 
-    return result;
+static void *wait_for_work(tpool_pool *pool, tdata_t *tdata) {
+    uint64_t idle_since = tpool_timer_now();
+    void *entry = search_for_work(pool, tdata, idle_since);
+    counter_add(&tdata->worker->counters.idle_ns, tpool_timer_now() - idle_since);
+    return entry;
 }
 
-static tpool_handle *task_handle_init() {
-    tpool_handle *handle = malloc(sizeof(tpool_handle));
-    handle->result = NULL;
-    handle->status = WAITING;
-    handle->waiter = NULL;
-    pthread_mutex_init(&handle->mutex, NULL);
-    pthread_cond_init(&handle->result_cond, NULL);
-    return handle;
+/**
+ * @brief Handles a task that just switched out, once its context has been
+ * fully saved: a yielded task is rescheduled, a blocked task is parked.
+ */
+static void suspend_task(tpool_pool *pool, task_t *task, park_fn park, void *park_arg) {
+    if (park == NULL) {
+        DEBUG("Enqueued task.\n");
+        schedule_yielded(pool, task);
+    } else if (!park(task, park_arg)) {
+        // woken while the task was switching out
+        task->type = RESUME;
+        schedule_task(pool, task);
+    }
 }
 
-tpool_handle *tpool_task_enqueue(tpool_pool *pool, tpool_work work, void *arg) {
-    task_t *task = malloc(sizeof(task_t));
-    task->type = INITIAL;
-    task->work = work;
-    task->arg = arg;
-    tpool_handle *handle = task_handle_init();
-    task->handle = handle;
+/**
+ * @brief Traces task stopping, along with the tasks beneath it on its stack.
+ */
+static void trace_suspend(tpool_trace *trace, task_t *task, tpool_trace_type type) {
+    tpool_trace_record(trace, type, task);
+    for (task_t *outer = task->outer; outer != NULL; outer = outer->outer) {
+        tpool_trace_record(trace, TPOOL_TRACE_SUSPEND, outer);
+    }
+}
 
-    tpool_enqueue(pool->task_queue, task);
+/**
+ * @brief Traces task continuing, after the tasks beneath it on its stack.
+ */
+static void trace_resume(tpool_trace *trace, task_t *task) {
+    if (task->outer != NULL) {
+        trace_resume(trace, task->outer);
+    }
+    tpool_trace_record(trace, TPOOL_TRACE_RESUME, task);
+}
 
-    modify_task_count(pool, 1);
+/**
+ * @brief The cache of worker for stacks of the size of stack, which may
+ * come from any worker of the pool.
+ */
+static tpool_stack_cache *stack_cache(tpool_worker *worker, tpool_stack *stack) {
+    for (int i = 0; i < TPOOL_STACK_CLASSES; i++) {
+        if (worker->stacks[i].stack_size == stack->size) {
+            return &worker->stacks[i];
+        }
+    }
+    ERROR("Stack of unknown size %zu.\n", stack->size);
+    return NULL;
+}
+
+/**
+ * @brief Completes the bookkeeping of the previous context. Must be called
+ * first thing after every switch.
+ */
+static void after_switch(tdata_t *tdata) {
+    if (tdata->release_stack != NULL) {
+        tpool_stack_release(stack_cache(tdata->worker, tdata->release_stack), tdata->release_stack);
+        tdata->release_stack = NULL;
+    }
+    if (tdata->suspended != NULL) {
+        task_t *task = tdata->suspended;
+        park_fn park = tdata->park;
+        void *park_arg = tdata->park_arg;
+        tdata->suspended = NULL;
+        tdata->park = NULL;
+        if (park != NULL) {
+            counter_add(&tdata->worker->counters.parked, 1);
+        }
+        if (__builtin_expect(tdata->trace != NULL, 0)) {
+            trace_suspend(tdata->trace, task, park != NULL ? TPOOL_TRACE_SUSPEND : TPOOL_TRACE_YIELD);
+        }
+        suspend_task(tdata->pool, task, park, park_arg);
+    }
+}
+
+static void worker_loop() __attribute__((noreturn));
 
-    return handle;
-}
\ No newline at end of file
+static void scheduler_entry() {
+    after_switch(get_tdata());
+    worker_loop();
+}
+
+/**
+ * @brief Suspends the current task. Tasks start on the stack of the
+ * scheduler that picked them up, so the current stack, along with the
+ * scheduler frames beneath the task, is handed to the task and the worker
+ * continues with a fresh scheduler on a new stack.
+ *
+ * Returns once the task is resumed, possibly on another thread.
+ */
+static void switch_to_scheduler(tdata_t *tdata, task_t *task) {
+    task->stack = tdata->stack;
+    tdata->stack = tpool_stack_alloc(&tdata->worker->stacks[TPOOL_STACK_DEFAULT]);
+    ASSERT(tdata->stack != NULL && "Failed to map scheduler stack.");
+    tpool_context_make(&tdata->sched_context, tdata->stack->base, tdata->stack->size, scheduler_entry);
+    tdata->suspended = task;
+    tdata->curr_task = NULL;
+    tpool_context_switch(&task->context, &tdata->sched_context);
+    after_switch(get_tdata());
+}
+
+/**
+ * @brief Switches to a suspended task. The current scheduler is abandoned
+ * and its stack released, since the task will return into the scheduler it
+ * was started by once it finishes.
+ */
+static void resume_task(tdata_t *tdata, task_t *task) __attribute__((noreturn));
+
+static void resume_task(tdata_t *tdata, task_t *task) {
+    DEBUG("Resuming task %p\n", task->handle);
+    tdata->release_stack = tdata->stack;
+    tdata->stack = task->stack;
+    tdata->curr_task = task;
+    tpool_context_switch(&tdata->sched_context, &task->context);
+    UNREACHABLE();
+}
+
+/**
+ * @brief Whether task may start on the current stack. Tasks of the default
+ * class fit any stack that is large enough, others only stacks of their
+ * class, so that they do not hold larger stacks while suspended.
+ */
+static bool stack_fits(tdata_t *tdata, task_t *task) {
+    size_t size = tdata->worker->stacks[task->stack_class].stack_size;
+    return task->stack_class == TPOOL_STACK_DEFAULT ? tdata->stack->size >= size : tdata->stack->size == size;
+}
+
+/**
+ * @brief Starts task on a fresh scheduler on a stack of its class. The
+ * current scheduler is abandoned and its stack released, as when resuming a
+ * task.
+ */
+static void start_on_stack(tdata_t *tdata, task_t *task) __attribute__((noreturn));
+
+static void start_on_stack(tdata_t *tdata, task_t *task) {
+    tpool_context abandoned;
+    tdata->release_stack = tdata->stack;
+    tdata->stack = tpool_stack_alloc(&tdata->worker->stacks[task->stack_class]);
+    ASSERT(tdata->stack != NULL && "Failed to map scheduler stack.");
+    tdata->pending = task;
+    tpool_context_make(&tdata->sched_context, tdata->stack->base, tdata->stack->size, scheduler_entry);
+    tpool_context_switch(&abandoned, &tdata->sched_context);
+    UNREACHABLE();
+}
+
+/**
+ * @brief Records that a task of work used bytes of stack.
+ */
+static void profile_record(tpool_profile_slot *slots, tpool_work work, uint64_t bytes) {
+    uintptr_t key = (uintptr_t) work;
+    size_t i = (size_t) (key >> 4) * 2654435761u;
+    for (size_t probe = 0; probe < TPOOL_STACK_PROFILE_SLOTS; probe++, i++) {
+        tpool_profile_slot *slot = &slots[i & (TPOOL_STACK_PROFILE_SLOTS - 1)];
+        uintptr_t found = atomic_load_explicit(&slot->work, memory_order_relaxed);
+        if (found == key) {
+            counter_add(&slot->runs, 1);
+            counter_max(&slot->max_bytes, bytes);
+            return;
+        }
+        if (found == 0) {
+            atomic_store_explicit(&slot->runs, 1, memory_order_relaxed);
+            atomic_store_explicit(&slot->max_bytes, bytes, memory_order_relaxed);
+            atomic_store_explicit(&slot->work, key, memory_order_release);
+            return;
+        }
+    }
+    // the table is full, so work goes unmeasured
+}
+
+/**
+ * @brief Runs a new task on the current stack, returning its result. The
+ * task may suspend and finish on another thread.
+ *
+ * When profiling, the stack below the frame the task starts from is painted
+ * first, unless the task is nested in another one whose use is still being
+ * measured, and the paint it overwrote is measured once it finishes.
+ */
+static void *run_inline(tdata_t *tdata, task_t *task) {
+    DEBUG("Running task %p\n", task->handle);
+    task_t *outer = tdata->curr_task;
+    task->outer = outer;
+    tdata->curr_task = task;
+    TRACE(tdata, TPOOL_TRACE_START, task);
+    char *top = NULL;
+    if (__builtin_expect(tdata->profile != NULL, 0)) {
+        top = __builtin_frame_address(0);
+        if (outer == NULL) {
+            // the frames of the painting itself stay above the paint
+            tpool_stack_paint(tdata->stack, top - TPOOL_STACK_PROFILE_FLOOR);
+        }
+    }
+    void *result = task->work(task->arg);
+    // tdata is invalidated if the task suspended
+    tdata = get_tdata();
+    if (__builtin_expect(top != NULL, 0)) {
+        uint64_t bytes = tpool_stack_measure(tdata->stack, top);
+        // a task that stays above the paint is only known to use no more
+        // than the floor
+        profile_record(tdata->profile, task->work, bytes > TPOOL_STACK_PROFILE_FLOOR ? bytes : 0);
+    }
+    tdata->curr_task = outer;
+    return result;
+}
+
+static void complete_task(tpool_pool *pool, task_t *task, void *result) {
+    // always on a worker of pool, either the one that took the task or its
+    // awaiter. Counted before the handle is signalled, so that a snapshot
+    // taken once every await has returned includes the task
+    tdata_t *tdata = get_tdata();
+    counter_add(&tdata->worker->counters.completed, 1);
+    TRACE(tdata, TPOOL_TRACE_COMPLETE, task);
+    if (!task->detached) {
+        tpool_handle *handle = task->handle;
+        handle->result = result;
+        uintptr_t state = atomic_exchange_explicit(&handle->state, FINISHED, memory_order_acq_rel);
+        if (state != WAITING) {
+            wake_waiter((tpool_waiter *) state);
+        }
+        DEBUG("Signaled handle %p\n", handle);
+    }
+    modify_task_count(pool, -1);
+    DEBUG("Finished task %p\n", task);
+}
+
+/**
+ * @brief Counts and traces a suspended task continuing, and switches to it.
+ */
+static void continue_task(tdata_t *tdata, task_t *task) __attribute__((noreturn));
+
+static void continue_task(tdata_t *tdata, task_t *task) {
+    counter_add(&tdata->worker->counters.resumed, 1);
+    if (__builtin_expect(tdata->trace != NULL, 0)) {
+        trace_resume(tdata->trace, task);
+    }
+    resume_task(tdata, task);
+}
+
+/**
+ * @brief Starts task on the current stack, unless it needs a stack of
+ * another class, and finishes it.
+ *
+ * If that wakes a task awaiting it, the worker switches straight to that
+ * task while the data they share is still in its cache, rather than
+ * queueing it. Other queued work is left for thieves meanwhile.
+ */
+static void start_task(tpool_pool *pool, tdata_t *tdata, task_t *task) {
+    if (__builtin_expect(!stack_fits(tdata, task), 0)) {
+        start_on_stack(tdata, task);
+    }
+    void *result = run_inline(tdata, task);
+    // the task may have suspended and finished on another worker
+    tdata = get_tdata();
+    tdata->completing = true;
+    complete_task(pool, task, result);
+    tdata->completing = false;
+    task_release(task);
+    if (tdata->handoff != NULL) {
+        task_t *next = tdata->handoff;
+        tdata->handoff = NULL;
+        continue_task(tdata, next);
+    }
+}
+
+/**
+ * @brief Runs one task. New tasks are run directly on the current stack
+ * and only get a stack of their own if they suspend.
+ *
+ * Notably, a task may suspend and finish on another thread, in which case
+ * this returns on that thread. Resuming a suspended task does not return.
+ *
+ * Returns true if the worker should exit.
+ */
+static bool launch_task(tpool_pool *pool) {
+    tdata_t *tdata = get_tdata();
+    if (__builtin_expect(tdata->pending != NULL, 0)) {
+        // moved here by start_on_stack
+        task_t *task = tdata->pending;
+        tdata->pending = NULL;
+        start_task(pool, tdata, task);
+        return false;
+    }
+    if (++tdata->ticks % TPOOL_POLL_INTERVAL == 0) {
+        run_timers(pool);
+        poll_io(pool, 0);
+    }
+    void *entry = find_task(pool, tdata);
+
+    if (entry == NULL && (entry = wait_for_work(pool, tdata)) == NULL) {
+        return true;
+    }
+    task_t *task = (task_t *) ((uintptr_t) entry & ~RESUME_ENTRY_TAG);
+    if (entry != task) {
+        if (task->type != RESUME) {
+            ERROR("Attempted to resume task which is not ready.\n");
+        }
+        lane_taken(tdata, task, true);
+        continue_task(tdata, task);
+    }
+    if (atomic_exchange_explicit(&task->started, true, memory_order_acq_rel)) {
+        // already run by its awaiter, and possibly suspended since
+        lane_taken(tdata, task, false);
+        task_release(task);
+        return false;
+    }
+    lane_taken(tdata, task, true);
+    if (task->type != INITIAL) {
+        ERROR("Invalid task type.\n");
+    }
+    start_task(pool, tdata, task);
+    return false;
+}
+
+static void worker_loop() {
+    while (!launch_task(get_tdata()->pool)) {}
+    tdata_t *tdata = get_tdata();
+    tdata->release_stack = tdata->stack;
+    tdata->stack = NULL;
+    tpool_context_switch(&tdata->sched_context, &tdata->native_context);
+    UNREACHABLE();
+}
+
+static void *pool_thread(void *arg) {
+    tpool_pool *pool = *(tpool_pool **) arg;
+    size_t id = *(size_t *) (arg + sizeof(tpool_pool *));
+    free(arg);
+
+    tpool_worker *worker = &pool->workers[id];
+    // before touching any memory, so that it is allocated on the worker's node
+    if (worker->cpu >= 0 && !tpool_topology_pin(worker->cpu)) {
+        WARN("Failed to pin T%02zu to CPU %d.\n", id, worker->cpu);
+    } else if (worker->cpu < 0 && pool->cpus != NULL && !tpool_topology_confine(pool->cpus, pool->cpu_count)) {
+        WARN("Failed to confine T%02zu to its CPUs.\n", id);
+    }
+    if (pool->nice != 0 && !tpool_topology_nice(pool->nice)) {
+        WARN("Failed to set the niceness of T%02zu to %d.\n", id, pool->nice);
+    }
+
+    tdata = (tdata_t) {
+        .init = true,
+        .self = pthread_self(),
+        .id = id,
+        .curr_task = NULL,
+        .park = NULL,
+        .ticks = 0,
+        .pool = pool,
+        .worker = worker,
+        .rng = (uint32_t) id * 2654435761u + 1,
+        .trace = worker->trace,
+        .profile = worker->profile,
+    };
+    // pthread_setspecific(thread_local_key, tdata);
+
+    // the scheduler never runs on the thread's own stack, which is only
+    // returned to in order to exit
+    tdata.stack = tpool_stack_alloc(&tdata.worker->stacks[TPOOL_STACK_DEFAULT]);
+    ASSERT(tdata.stack != NULL && "Failed to map scheduler stack.");
+    tpool_context_make(&tdata.sched_context, tdata.stack->base, tdata.stack->size, scheduler_entry);
+    tpool_context_switch(&tdata.native_context, &tdata.sched_context);
+    after_switch(&tdata);
+    if (id >= pool->pool_size) {
+        atomic_store_explicit(&worker->state, WORKER_RETIRED, memory_order_release);
+    }
+    return NULL;
+}
+
+static void worker_init(tpool_pool *pool, size_t id) {
+    tpool_worker *worker = &pool->workers[id];
+    for (int prio = 0; prio < TPOOL_PRIO_LEVELS; prio++) {
+        tpool_lane *lane = &worker->lanes[prio];
+        tpool_deque_init(&lane->deque);
+        tpool_deque_init(&lane->yields);
+        atomic_init(&lane->pushed, 0);
+        atomic_init(&lane->taken, 0);
+        atomic_init(&lane->wait_samples, 0);
+        atomic_init(&lane->wait_ticks, 0);
+        atomic_init(&lane->max_wait_ticks, 0);
+    }
+    // binding only pays off when there is another node to avoid
+    int node = pool->node_count > 1 ? worker->node : -1;
+    for (int i = 0; i < TPOOL_STACK_CLASSES; i++) {
+        tpool_stack_cache_init(
+            &worker->stacks[i], pool->stack_sizes[i], pool->stack_cache_size, node, &pool->stack_resident
+        );
+    }
+    tpool_slab_init(&worker->slab, node);
+    atomic_init(&worker->state, WORKER_STOPPED);
+    worker->trace = NULL;
+    if (pool->trace_events > 0 && (worker->trace = tpool_trace_init(pool->trace_events)) == NULL) {
+        WARN("Failed to allocate the trace of T%02zu.\n", id);
+    }
+    worker->profile = NULL;
+    if (pool->stack_profile
+        && (worker->profile = calloc(TPOOL_STACK_PROFILE_SLOTS, sizeof(tpool_profile_slot))) == NULL) {
+        WARN("Failed to allocate the stack profile of T%02zu.\n", id);
+    }
+    tpool_counters *counters = &worker->counters;
+    atomic_init(&counters->spawned, 0);
+    atomic_init(&counters->completed, 0);
+    atomic_init(&counters->resumed, 0);
+    atomic_init(&counters->yielded, 0);
+    atomic_init(&counters->parked, 0);
+    atomic_init(&counters->steal_attempts, 0);
+    atomic_init(&counters->steals, 0);
+    atomic_init(&counters->idle_ns, 0);
+    atomic_init(&counters->max_queue_depth, 0);
+}
+
+static void worker_destroy(tpool_worker *worker) {
+    for (int prio = 0; prio < TPOOL_PRIO_LEVELS; prio++) {
+        tpool_deque_free(&worker->lanes[prio].deque);
+        tpool_deque_free(&worker->lanes[prio].yields);
+    }
+    for (int i = 0; i < TPOOL_STACK_CLASSES; i++) {
+        tpool_stack_cache_free(&worker->stacks[i]);
+    }
+    tpool_slab_destroy(&worker->slab);
+    tpool_trace_free(worker->trace);
+    free(worker->profile);
+}
+
+/**
+ * @brief Starts the thread of the worker in slot id. Returns 0 or the error
+ * of pthread_create.
+ */
+static int worker_start(tpool_pool *pool, size_t id) {
+    void *thread_start_arg = malloc(sizeof(tpool_pool *) + sizeof(size_t));
+    *(tpool_pool **) thread_start_arg = pool;
+    *(size_t *) (thread_start_arg + sizeof(tpool_pool *)) = id;
+    atomic_store_explicit(&pool->workers[id].state, WORKER_RUNNING, memory_order_relaxed);
+    int ret = pthread_create(&pool->workers[id].thread, NULL, pool_thread, thread_start_arg);
+    if (ret) {
+        atomic_store_explicit(&pool->workers[id].state, WORKER_STOPPED, memory_order_relaxed);
+        free(thread_start_arg);
+    }
+    return ret;
+}
+
+/**
+ * @brief Starts an extra worker, in the slot of one which has retired if
+ * there is one. Called by the monitor only.
+ */
+static void spawn_extra_worker(tpool_pool *pool) {
+    size_t slots = atomic_load_explicit(&pool->slot_count, memory_order_relaxed);
+    size_t id = slots;
+    for (size_t i = pool->pool_size; i < slots; i++) {
+        tpool_worker *worker = &pool->workers[i];
+        if (atomic_load_explicit(&worker->state, memory_order_acquire) == WORKER_RETIRED) {
+            pthread_join(worker->thread, NULL);
+            atomic_store_explicit(&worker->state, WORKER_STOPPED, memory_order_relaxed);
+        }
+        if (id == slots && atomic_load_explicit(&worker->state, memory_order_relaxed) == WORKER_STOPPED) {
+            id = i;
+        }
+    }
+    if (id == slots) {
+        if (slots == pool->max_size) {
+            return;
+        }
+        pool->workers[id].cpu = -1;
+        pool->workers[id].node = -1;
+        worker_init(pool, id);
+        // thieves only look at initialized slots
+        atomic_store_explicit(&pool->slot_count, slots + 1, memory_order_release);
+    }
+    if (worker_start(pool, id)) {
+        WARN("Failed to start an extra worker.\n");
+    } else {
+        DEBUG("Started extra worker T%02zu.\n", id);
+    }
+}
+
+/**
+ * @brief Whether tasks are queued that no worker is free to run because
+ * some are in blocking regions.
+ */
+static bool needs_extra_worker(tpool_pool *pool) {
+    return atomic_load(&pool->blocking) > 0
+        && atomic_load(&pool->searching) == 0
+        && !tpool_eventcount_has_waiters(&pool->idle)
+        && !atomic_load(&pool->watching)
+        && has_work(pool);
+}
+
+static void *monitor_thread(void *arg) {
+    tpool_pool *pool = arg;
+    while (!atomic_load(&pool->closing)) {
+        uint32_t key = atomic_load(&pool->monitor_epoch);
+        if (atomic_load(&pool->blocking) == 0) {
+            // woken by the first worker to enter a blocking region
+            if (!atomic_load(&pool->closing)) {
+                tpool_futex_wait(&pool->monitor_epoch, key);
+            }
+            continue;
+        }
+        struct timespec ts = {.tv_sec = 0, .tv_nsec = TPOOL_MONITOR_INTERVAL};
+        tpool_futex_wait_for(&pool->monitor_epoch, key, &ts);
+        if (!atomic_load(&pool->closing) && needs_extra_worker(pool)) {
+            spawn_extra_worker(pool);
+        }
+    }
+    return NULL;
+}
+
+static void wake_monitor(tpool_pool *pool) {
+    atomic_fetch_add(&pool->monitor_epoch, 1);
+    tpool_futex_wake(&pool->monitor_epoch, 1);
+}
+
+tpool_pool *tpool_init(size_t size) {
+    return tpool_init_config(&(tpool_config) {.size = size});
+}
+
+tpool_pool *tpool_init_config(const tpool_config *config) {
+    tpool_topology topology;
+    if (!tpool_topology_init(&topology)) {
+        return NULL;
+    }
+    if (config->cpus != NULL && !tpool_topology_restrict(&topology, config->cpus, config->cpu_count)) {
+        WARN("None of the configured CPUs are available.\n");
+        tpool_topology_free(&topology);
+        return NULL;
+    }
+    size_t size = config->size ? config->size : topology.cpu_count;
+    size_t max_size = config->max_size ? config->max_size : size + TPOOL_DEFAULT_EXTRA_WORKERS;
+    max_size = max_size > size ? max_size : size;
+
+    tpool_pool *pool = malloc(sizeof(tpool_pool) + sizeof(tpool_worker) * max_size);
+
+    pool->stack_sizes[TPOOL_STACK_DEFAULT] = config->stack_size ? config->stack_size : TPOOL_DEFAULT_STACK_SIZE;
+    pool->stack_sizes[TPOOL_STACK_SMALL] = config->small_stack_size
+        ? config->small_stack_size : TPOOL_DEFAULT_SMALL_STACK_SIZE;
+    pool->stack_sizes[TPOOL_STACK_LARGE] = config->large_stack_size
+        ? config->large_stack_size : TPOOL_DEFAULT_LARGE_STACK_SIZE;
+    pool->stack_cache_size = config->stack_cache_size
+        ? config->stack_cache_size : TPOOL_DEFAULT_STACK_CACHE_SIZE;
+    pool->stack_profile = config->stack_profile;
+    atomic_init(&pool->stack_resident, 0);
+
+    pool->pool_size = size;
+    pool->max_size = max_size;
+    atomic_init(&pool->slot_count, size);
+    atomic_init(&pool->blocking, 0);
+    atomic_init(&pool->monitor_epoch, 0);
+    pool->monitored = false;
+    pool->idle_timeout = config->idle_timeout_ns ? config->idle_timeout_ns : TPOOL_DEFAULT_IDLE_TIMEOUT;
+    pool->trace_events = config->trace_events;
+    pool->trace_start = tpool_trace_epoch_now();
+    pool->node_count = config->pin ? topology.node_count : 1;
+    for (size_t i = 0; i < size; i++) {
+        // with more workers than CPUs, the extra ones double up from the start
+        pool->workers[i].cpu = config->pin ? topology.cpus[i % topology.cpu_count] : -1;
+        pool->workers[i].node = config->pin ? topology.nodes[i % topology.cpu_count] : -1;
+    }
+    // unpinned workers, extra ones included, are confined to the list instead
+    pool->cpus = NULL;
+    pool->cpu_count = 0;
+    if (config->cpus != NULL) {
+        pool->cpus = topology.cpus;
+        pool->cpu_count = topology.cpu_count;
+        topology.cpus = NULL;
+    }
+    pool->nice = config->nice;
+    tpool_topology_free(&topology);
+    atomic_init(&pool->task_count, 0);
+    tpool_eventcount_init(&pool->idle);
+    atomic_init(&pool->searching, 0);
+    atomic_init(&pool->waking, false);
+    atomic_init(&pool->closing, false);
+    pool->reactor = tpool_reactor_init();
+    atomic_init(&pool->io_waiting, 0);
+    atomic_init(&pool->polling, false);
+    tpool_timer_wheel_init(&pool->timers, tpool_timer_now());
+    atomic_init(&pool->timer_count, 0);
+    atomic_init(&pool->next_timer, UINT64_MAX);
+    atomic_init(&pool->watching, false);
+    atomic_init(&pool->watch_state, WATCH_NONE);
+    atomic_init(&pool->watch_epoch, 0);
+
+    ASSERT(!pthread_mutex_init(&pool->task_count_mutex, NULL));
+    ASSERT(!pthread_cond_init(&pool->task_count_cond, NULL));
+    ASSERT(!pthread_mutex_init(&pool->timer_mutex, NULL));
+
+    for (int prio = 0; prio < TPOOL_PRIO_LEVELS; prio++) {
+        pool->task_queues[prio] = tpool_queue_init();
+        atomic_init(&pool->injected[prio], 0);
+    }
+    atomic_init(&pool->external_spawned, 0);
+    for (size_t i = 0; i < size; i++) {
+        worker_init(pool, i);
+    }
+    tpool_slab_init(&pool->shared_slab, -1);
+    ASSERT(!pthread_mutex_init(&pool->shared_slab_mutex, NULL));
+
+    // spawn the thread pool
+    size_t i;
+    for (i = 0; i < size; i++) {
+        if (worker_start(pool, i)) {
+            goto FAIL;
+        }
+    }
+    if (max_size > size) {
+        pool->monitored = !pthread_create(&pool->monitor, NULL, monitor_thread, pool);
+        if (!pool->monitored) {
+            WARN("Failed to start the monitor thread.\n");
+        }
+    }
+    return pool;
+    FAIL:
+    for (int prio = 0; prio < TPOOL_PRIO_LEVELS; prio++) {
+        tpool_queue_free(pool->task_queues[prio]);
+    }
+    if (pool->reactor != NULL) {
+        tpool_reactor_free(pool->reactor);
+    }
+    for (size_t j = 0; j < i; j++) {
+        pthread_kill(pool->workers[j].thread, SIGKILL);
+    }
+    for (size_t j = 0; j < size; j++) {
+        worker_destroy(&pool->workers[j]);
+    }
+    tpool_slab_destroy(&pool->shared_slab);
+    free(pool->cpus);
+    free(pool);
+    return NULL;
+}
+
+tpool_pool *tpool_current_pool(void) {
+    tdata_t *tdata = get_tdata();
+    return tdata != NULL ? tdata->pool : NULL;
+}
+
+void tpool_close(tpool_pool *pool) {
+    pthread_mutex_lock(&pool->task_count_mutex);
+    while (atomic_load(&pool->task_count) > 0) {
+        pthread_cond_wait(&pool->task_count_cond, &pool->task_count_mutex);
+    }
+    pthread_mutex_unlock(&pool->task_count_mutex);
+
+    // idle workers will exit instead of blocking
+    atomic_store(&pool->closing, true);
+    tpool_eventcount_notify(&pool->idle, INT_MAX);
+    wake_watcher(pool, atomic_load(&pool->watch_state));
+    if (pool->monitored) {
+        wake_monitor(pool);
+        pthread_join(pool->monitor, NULL);
+    }
+
+    // no workers are started from here on
+    size_t slots = atomic_load(&pool->slot_count);
+    for (size_t i = 0; i < slots; i++) {
+        if (atomic_load(&pool->workers[i].state) != WORKER_STOPPED) {
+            pthread_join(pool->workers[i].thread, NULL);
+        }
+    }
+    for (int prio = 0; prio < TPOOL_PRIO_LEVELS; prio++) {
+        tpool_queue_free(pool->task_queues[prio]);
+    }
+    if (pool->reactor != NULL) {
+        tpool_reactor_free(pool->reactor);
+    }
+    for (size_t i = 0; i < slots; i++) {
+        worker_destroy(&pool->workers[i]);
+    }
+    tpool_slab_destroy(&pool->shared_slab);
+    free(pool->cpus);
+    free(pool);
+}
+
+void tpool_get_lane_stats(tpool_pool *pool, tpool_lane_stats stats[TPOOL_PRIO_LEVELS]) {
+    for (int prio = 0; prio < TPOOL_PRIO_LEVELS; prio++) {
+        uint64_t pushed = atomic_load_explicit(&pool->injected[prio], memory_order_relaxed);
+        uint64_t taken = 0;
+        uint64_t wait_samples = 0;
+        uint64_t wait_ticks = 0;
+        uint64_t max_wait_ticks = 0;
+        size_t slots = atomic_load_explicit(&pool->slot_count, memory_order_acquire);
+        for (size_t i = 0; i < slots; i++) {
+            tpool_lane *lane = &pool->workers[i].lanes[prio];
+            pushed += atomic_load_explicit(&lane->pushed, memory_order_relaxed);
+            taken += atomic_load_explicit(&lane->taken, memory_order_relaxed);
+            wait_samples += atomic_load_explicit(&lane->wait_samples, memory_order_relaxed);
+            wait_ticks += atomic_load_explicit(&lane->wait_ticks, memory_order_relaxed);
+            uint64_t max = atomic_load_explicit(&lane->max_wait_ticks, memory_order_relaxed);
+            max_wait_ticks = max > max_wait_ticks ? max : max_wait_ticks;
+        }
+        stats[prio] = (tpool_lane_stats) {
+            // the counters are read one by one, so a take may be seen
+            // without its push
+            .depth = pushed > taken ? pushed - taken : 0,
+            .taken = taken,
+            .mean_wait_ns = wait_samples > 0 ? (wait_ticks << TPOOL_TIMER_TICK_SHIFT) / wait_samples : 0,
+            .max_wait_ns = max_wait_ticks << TPOOL_TIMER_TICK_SHIFT,
+        };
+    }
+}
+
+static void worker_stats(tpool_worker *worker, tpool_worker_stats *stats) {
+    tpool_counters *counters = &worker->counters;
+    *stats = (tpool_worker_stats) {
+        .spawned = atomic_load_explicit(&counters->spawned, memory_order_relaxed),
+        .completed = atomic_load_explicit(&counters->completed, memory_order_relaxed),
+        .resumed = atomic_load_explicit(&counters->resumed, memory_order_relaxed),
+        .yielded = atomic_load_explicit(&counters->yielded, memory_order_relaxed),
+        .parked = atomic_load_explicit(&counters->parked, memory_order_relaxed),
+        .steal_attempts = atomic_load_explicit(&counters->steal_attempts, memory_order_relaxed),
+        .steals = atomic_load_explicit(&counters->steals, memory_order_relaxed),
+        .idle_ns = atomic_load_explicit(&counters->idle_ns, memory_order_relaxed),
+        .max_queue_depth = atomic_load_explicit(&counters->max_queue_depth, memory_order_relaxed),
+    };
+    for (int i = 0; i < TPOOL_STACK_CLASSES; i++) {
+        stats->stack_hits += atomic_load_explicit(&worker->stacks[i].hits, memory_order_relaxed);
+        stats->stack_misses += atomic_load_explicit(&worker->stacks[i].misses, memory_order_relaxed);
+    }
+}
+
+size_t tpool_get_worker_stats(tpool_pool *pool, tpool_worker_stats *stats, size_t max) {
+    size_t slots = atomic_load_explicit(&pool->slot_count, memory_order_acquire);
+    for (size_t i = 0; i < slots && i < max; i++) {
+        worker_stats(&pool->workers[i], &stats[i]);
+    }
+    return slots;
+}
+
+void tpool_stats_snapshot(tpool_pool *pool, tpool_stats *stats) {
+    *stats = (tpool_stats) {
+        .blocking = atomic_load_explicit(&pool->blocking, memory_order_relaxed),
+        .tasks = atomic_load_explicit(&pool->task_count, memory_order_relaxed),
+        .total.spawned = atomic_load_explicit(&pool->external_spawned, memory_order_relaxed),
+    };
+    tpool_worker_stats *total = &stats->total;
+    size_t slots = atomic_load_explicit(&pool->slot_count, memory_order_acquire);
+    for (size_t i = 0; i < slots; i++) {
+        if (atomic_load_explicit(&pool->workers[i].state, memory_order_relaxed) == WORKER_RUNNING) {
+            stats->workers++;
+        }
+        tpool_worker_stats worker;
+        worker_stats(&pool->workers[i], &worker);
+        total->spawned += worker.spawned;
+        total->completed += worker.completed;
+        total->resumed += worker.resumed;
+        total->yielded += worker.yielded;
+        total->parked += worker.parked;
+        total->steal_attempts += worker.steal_attempts;
+        total->steals += worker.steals;
+        total->idle_ns += worker.idle_ns;
+        if (worker.max_queue_depth > total->max_queue_depth) {
+            total->max_queue_depth = worker.max_queue_depth;
+        }
+        total->stack_hits += worker.stack_hits;
+        total->stack_misses += worker.stack_misses;
+    }
+}
+
+int tpool_trace_dump(tpool_pool *pool, const char *path) {
+    if (pool->trace_events == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t slots = atomic_load_explicit(&pool->slot_count, memory_order_acquire);
+    tpool_trace **traces = malloc(slots * sizeof(tpool_trace *));
+    if (traces == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < slots; i++) {
+        traces[i] = pool->workers[i].trace;
+    }
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        free(traces);
+        return -1;
+    }
+    int ret = tpool_trace_write(file, traces, slots, pool->trace_start);
+    free(traces);
+    if (fclose(file) && ret == 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+void tpool_get_stack_stats(tpool_pool *pool, tpool_stack_stats *stats) {
+    *stats = (tpool_stack_stats) {0};
+    size_t slots = atomic_load_explicit(&pool->slot_count, memory_order_acquire);
+    for (size_t i = 0; i < slots; i++) {
+        for (int j = 0; j < TPOOL_STACK_CLASSES; j++) {
+            tpool_stack_cache_stats(&pool->workers[i].stacks[j], stats);
+        }
+    }
+    stats->resident_bytes = atomic_load_explicit(&pool->stack_resident, memory_order_relaxed);
+}
+
+static int compare_stack_usage(const void *a, const void *b) {
+    uint64_t x = ((const tpool_stack_usage *) a)->max_bytes;
+    uint64_t y = ((const tpool_stack_usage *) b)->max_bytes;
+    return (x < y) - (x > y);
+}
+
+size_t tpool_get_stack_profile(tpool_pool *pool, tpool_stack_usage *usage, size_t max) {
+    size_t count = 0;
+    size_t slots = atomic_load_explicit(&pool->slot_count, memory_order_acquire);
+    for (size_t i = 0; i < slots; i++) {
+        tpool_profile_slot *profile = pool->workers[i].profile;
+        for (size_t j = 0; profile != NULL && j < TPOOL_STACK_PROFILE_SLOTS; j++) {
+            uintptr_t work = atomic_load_explicit(&profile[j].work, memory_order_acquire);
+            if (work == 0) {
+                continue;
+            }
+            uint64_t runs = atomic_load_explicit(&profile[j].runs, memory_order_relaxed);
+            uint64_t max_bytes = atomic_load_explicit(&profile[j].max_bytes, memory_order_relaxed);
+            size_t k = 0;
+            while (k < count && usage[k].work != (tpool_work) work) {
+                k++;
+            }
+            if (k < count) {
+                usage[k].runs += runs;
+                usage[k].max_bytes = max_bytes > usage[k].max_bytes ? max_bytes : usage[k].max_bytes;
+            } else if (count < max) {
+                usage[count++] = (tpool_stack_usage) {
+                    .work = (tpool_work) work,
+                    .runs = runs,
+                    .max_bytes = max_bytes,
+                };
+            }
+        }
+    }
+    qsort(usage, count, sizeof(tpool_stack_usage), compare_stack_usage);
+    return count;
+}
+
+/**
+ * @brief Yields execution to the threadpool, enqueueing a resume task so that
+ * the threadpool can resume execution of the current task eventually.
+ * Returns right away if no other task is runnable.
+ *
+ * Assumes the calling thread is a threadpool thread.
+ *
+ * May return in different thread than the caller, but returns exactly once.
+ */
+void tpool_yield() {
+    tdata_t *tdata = get_tdata();
+    tpool_pool *pool = tdata->pool;
+    if (!worker_has_work(tdata->worker) && !has_injected_work(pool)) {
+        // the scheduler would take this task back before stealing anything,
+        // so steal here in case the owner of other work is stuck in a
+        // blocking call, and queue it to go first
+        void *entry = steal_any(pool, tdata);
+        if (entry == NULL) {
+            // nothing else could run here, so skip the round trip through
+            // the queues, but keep polling so that a task yielding until an
+            // fd is ready cannot keep the worker from ever polling it
+            counter_add(&tdata->worker->counters.yielded, 1);
+            if (++tdata->ticks % TPOOL_POLL_INTERVAL == 0) {
+                run_timers(pool);
+                poll_io(pool, 0);
+            }
+            return;
+        }
+        task_t *stolen = (task_t *) ((uintptr_t) entry & ~RESUME_ENTRY_TAG);
+        tpool_deque_push(&tdata->worker->lanes[stolen->prio].deque, entry);
+    }
+    task_t *task = tdata->curr_task;
+    task->type = RESUME;
+    DEBUG("Yielding task %p.\n", task->handle);
+    switch_to_scheduler(tdata, task);
+    DEBUG("Resuming %p.\n", task->handle);
+}
+
+static bool handle_finished(tpool_handle *handle) {
+    return atomic_load_explicit(&handle->state, memory_order_acquire) == FINISHED;
+}
+
+/**
+ * @brief Registers waiter as the awaiter of handle. Returns false if the
+ * handle has already finished.
+ */
+static bool handle_add_waiter(tpool_handle *handle, tpool_waiter *waiter) {
+    uintptr_t state = WAITING;
+    if (atomic_compare_exchange_strong_explicit(
+        &handle->state, &state, (uintptr_t) waiter, memory_order_acq_rel, memory_order_acquire
+    )) {
+        return true;
+    }
+    ASSERT(state == FINISHED && "Handle awaited more than once.");
+    return false;
+}
+
+static bool park_on_handle(task_t *task, void *handle) {
+    return handle_add_waiter(handle, &task->waiter);
+}
+
+typedef struct io_park {
+    int fd;
+    int dir;
+    int result;
+    int error;
+} io_park;
+
+static bool park_on_fd(task_t *task, void *arg) {
+    io_park *io = arg;
+    tpool_pool *pool = task->pool;
+    atomic_fetch_add_explicit(&pool->io_waiting, 1, memory_order_relaxed);
+    // io lives on the task's stack, which may be gone as soon as the waiter
+    // is registered
+    int result = tpool_reactor_add_waiter(pool->reactor, io->fd, io->dir, &task->waiter);
+    if (result == 1) {
+        return true;
+    }
+    io->result = result;
+    io->error = errno;
+    atomic_fetch_sub_explicit(&pool->io_waiting, 1, memory_order_relaxed);
+    return false;
+}
+
+int tpool_wait_fd(int fd, bool write) {
+    tdata_t *tdata = get_tdata();
+    struct pollfd pfd = {.fd = fd, .events = write ? POLLOUT : POLLIN};
+    if (tdata == NULL) {
+        return poll(&pfd, 1, -1) < 0 ? -1 : 0;
+    }
+    if (tdata->pool->reactor == NULL) {
+        while (poll(&pfd, 1, 0) == 0) {
+            tpool_yield();
+        }
+        return 0;
+    }
+    task_t *task = tdata->curr_task;
+    io_park io = {.fd = fd, .dir = write ? TPOOL_IO_WRITE : TPOOL_IO_READ};
+    task->type = BLOCKED;
+    tdata->park = park_on_fd;
+    tdata->park_arg = &io;
+    DEBUG("Waiting on fd %d.\n", fd);
+    switch_to_scheduler(tdata, task);
+    if (io.result < 0) {
+        errno = io.error;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * A task sleeping until a deadline, or until a handle finishes if handle is
+ * set. Lives on the task's stack.
+ */
+typedef struct timer_park {
+    tpool_timer timer;
+    task_t *task;
+    tpool_handle *handle;
+} timer_park;
+
+static void timer_wake(tpool_timer *timer) {
+    timer_park *park = (timer_park *) timer;
+    task_t *task = park->task;
+    if (park->handle != NULL) {
+        // take the waiter back, unless the handle finished and wakes it
+        uintptr_t state = (uintptr_t) &task->waiter;
+        if (!atomic_compare_exchange_strong_explicit(
+            &park->handle->state, &state, WAITING, memory_order_acq_rel, memory_order_acquire
+        )) {
+            return;
+        }
+    }
+    wake_waiter(&task->waiter);
+}
+
+static bool park_on_timer(task_t *task, void *arg) {
+    timer_park *park = arg;
+    tpool_pool *pool = task->pool;
+    // The timer cannot fire before the waiter is registered with the handle
+    // since both happen under timer_mutex.
+    pthread_mutex_lock(&pool->timer_mutex);
+    bool parked = add_timer(pool, &park->timer);
+    if (parked && park->handle != NULL && !handle_add_waiter(park->handle, &task->waiter)) {
+        tpool_timer_remove(&pool->timers, &park->timer);
+        timers_updated(pool);
+        parked = false;
+    }
+    pthread_mutex_unlock(&pool->timer_mutex);
+    return parked;
+}
+
+static void sleep_on_timer(tdata_t *tdata, timer_park *park) {
+    task_t *task = tdata->curr_task;
+    park->task = task;
+    park->timer.fire = timer_wake;
+    task->type = BLOCKED;
+    tdata->park = park_on_timer;
+    tdata->park_arg = park;
+    switch_to_scheduler(tdata, task);
+}
+
+void tpool_sleep_until(uint64_t deadline) {
+    tdata_t *tdata = get_tdata();
+    if (tdata == NULL) {
+        struct timespec ts = {.tv_sec = deadline / 1000000000, .tv_nsec = deadline % 1000000000};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+        return;
+    }
+    if (deadline <= tpool_timer_now()) {
+        return;
+    }
+    timer_park park = {.timer.deadline = deadline, .handle = NULL};
+    DEBUG("Sleeping task %p.\n", tdata->curr_task->handle);
+    sleep_on_timer(tdata, &park);
+}
+
+void *tpool_blocking(tpool_work work, void *arg) {
+    tdata_t *tdata = get_tdata();
+    if (tdata == NULL) {
+        return work(arg);
+    }
+    tpool_pool *pool = tdata->pool;
+    if (atomic_fetch_add(&pool->blocking, 1) == 0 && pool->monitored) {
+        wake_monitor(pool);
+    }
+    void *result = work(arg);
+    atomic_fetch_sub(&pool->blocking, 1);
+    return result;
+}
+
+/**
+ * @brief Waits for handle to finish until deadline, without releasing it.
+ * Returns whether it finished.
+ */
+static bool await_until(tpool_handle *handle, uint64_t deadline) {
+    if (!handle_finished(handle)) {
+        tdata_t *tdata = get_tdata();
+        if (tdata) {
+            timer_park park = {.timer.deadline = deadline, .handle = handle};
+            sleep_on_timer(tdata, &park);
+            // also waits for the timer to finish firing if it raced with the
+            // handle, since it refers to the park
+            tpool_pool *pool = park.task->pool;
+            pthread_mutex_lock(&pool->timer_mutex);
+            tpool_timer_remove(&pool->timers, &park.timer);
+            timers_updated(pool);
+            pthread_mutex_unlock(&pool->timer_mutex);
+        } else {
+            tpool_waiter waiter = {.task = NULL};
+            atomic_init(&waiter.woken, 0);
+            if (handle_add_waiter(handle, &waiter)) {
+                uint64_t now;
+                while (!atomic_load_explicit(&waiter.woken, memory_order_acquire)
+                    && (now = tpool_timer_now()) < deadline) {
+                    uint64_t timeout = deadline - now;
+                    struct timespec ts = {.tv_sec = timeout / 1000000000, .tv_nsec = timeout % 1000000000};
+                    tpool_futex_wait_for(&waiter.woken, 0, &ts);
+                }
+                uintptr_t state = (uintptr_t) &waiter;
+                if (!atomic_compare_exchange_strong_explicit(
+                    &handle->state, &state, WAITING, memory_order_acq_rel, memory_order_acquire
+                )) {
+                    // finishing, and about to wake the waiter
+                    wait_waiter(&waiter);
+                }
+            }
+        }
+    }
+    return handle_finished(handle);
+}
+
+bool tpool_task_await_until(tpool_handle *handle, uint64_t deadline, void **result) {
+    if (!await_until(handle, deadline)) {
+        return false;
+    }
+    if (result != NULL) {
+        *result = handle->result;
+    }
+    task_release(handle->task);
+    return true;
+}
+
+bool tpool_task_await_until_into(tpool_handle *handle, uint64_t deadline, void *result, size_t size) {
+    if (!await_until(handle, deadline)) {
+        return false;
+    }
+    memcpy(result, handle->result, size);
+    task_release(handle->task);
+    return true;
+}
+
+/**
+ * @brief Whether the current stack has room to run task inline: it must be
+ * at least the size of the task's class, and nested tasks may use up to
+ * half of it; the rest is left for the innermost one.
+ */
+static bool stack_has_room(tdata_t *tdata, task_t *task) {
+    char *sp = __builtin_frame_address(0);
+    return tdata->stack->size >= tdata->worker->stacks[task->stack_class].stack_size
+        && (size_t) (sp - (char *) tdata->stack->base) > tdata->stack->size / 2;
+}
+
+/**
+ * @brief Claims an unstarted task for the caller.
+ */
+static bool claim_task(task_t *task) {
+    return !atomic_load_explicit(&task->started, memory_order_relaxed)
+        && !atomic_exchange_explicit(&task->started, true, memory_order_acq_rel);
+}
+
+/**
+ * @brief Runs the task of handle on the current stack if no worker has
+ * started it yet.
+ *
+ * Returns the thread data, which changes if the task suspended.
+ */
+static tdata_t *await_inline(tdata_t *tdata, tpool_handle *handle) {
+    task_t *target = handle->task;
+    if (
+        !handle_finished(handle) && tdata && target->pool == tdata->pool
+        && stack_has_room(tdata, target) && claim_task(target)
+    ) {
+        // Still queued, so run it here rather than parking until a worker
+        // gets to it. Its queue entry is dropped when dequeued.
+        DEBUG("Running awaited task %p inline.\n", handle);
+        void *result = run_inline(tdata, target);
+        complete_task(target->pool, target, result);
+        tdata = get_tdata();
+    }
+    return tdata;
+}
+
+/**
+ * @brief Waits for handle to finish, without releasing it.
+ */
+static void await_handle(tpool_handle *handle) {
+    DEBUG("Awaiting handle %p.\n", handle);
+    tdata_t *tdata = await_inline(get_tdata(), handle);
+    if (!handle_finished(handle)) {
+        if (tdata) {
+            // The waiter is registered by the scheduler once the context is
+            // saved, otherwise the task could be resumed before it suspends.
+            task_t *task = tdata->curr_task;
+            task->type = BLOCKED;
+            tdata->park = park_on_handle;
+            tdata->park_arg = handle;
+            DEBUG("Yielding task %p.\n", task->handle);
+            switch_to_scheduler(tdata, task);
+            // tdata is invalidated past this point, since executation may
+            // continue in another thread.
+            DEBUG("Resuming %p.\n", task->handle);
+        } else {
+            tpool_waiter waiter = {.task = NULL};
+            atomic_init(&waiter.woken, 0);
+            if (handle_add_waiter(handle, &waiter)) {
+                wait_waiter(&waiter);
+            }
+        }
+    }
+    DEBUG("Done waiting on handle %p.\n", handle);
+}
+
+void *tpool_task_await(tpool_handle *handle) {
+    task_t *target = handle->task;
+    await_handle(handle);
+    void *result = handle->result;
+    task_release(target);
+    return result;
+}
+
+void *tpool_task_await_into(tpool_handle *handle, void *result, size_t size) {
+    task_t *target = handle->task;
+    await_handle(handle);
+    // the result may live in the task's record, which the release can free
+    memcpy(result, handle->result, size);
+    task_release(target);
+    return result;
+}
+
+/**
+ * @brief Allocates a latch woken once count of n handles have finished.
+ */
+static tpool_latch *latch_alloc(tdata_t *tdata, size_t n, size_t count) {
+    size_t size = sizeof(tpool_latch) + n * sizeof(tpool_waiter);
+    tpool_latch *latch = tdata != NULL ? tpool_slab_alloc(&tdata->worker->slab, size) : NULL;
+    bool slab = latch != NULL;
+    if (!slab) {
+        latch = malloc(size);
+        ASSERT(latch != NULL && "Allocation failed in latch_alloc.");
+    }
+    latch->slab = slab;
+    atomic_init(&latch->count, count);
+    atomic_init(&latch->refs, n + 1);
+    atomic_init(&latch->state, LATCH_REGISTERING);
+    latch->registered = 0;
+    latch->last = 0;
+    latch->waiter = (tpool_waiter) {.task = tdata != NULL ? tdata->curr_task : NULL};
+    for (size_t i = 0; i < n; i++) {
+        latch->entries[i] = (tpool_waiter) {.latch = latch};
+    }
+    return latch;
+}
+
+typedef struct latch_park {
+    tpool_latch *latch;
+    tpool_handle **handles;
+    size_t n;
+} latch_park;
+
+/**
+ * @brief Registers the latch with each handle in turn, counting it down for
+ * handles found finished. Stops early once the count reaches zero, since
+ * later handles cannot matter.
+ *
+ * Returns false if the latch reached zero and the waiter should not sleep.
+ */
+static bool latch_register(latch_park *park) {
+    tpool_latch *latch = park->latch;
+    size_t i;
+    for (i = 0; i < park->n; i++) {
+        if (handle_add_waiter(park->handles[i], &latch->entries[i])) {
+            continue;
+        }
+        latch_release(latch);
+        if (latch_count_down(latch)) {
+            latch->last = i;
+            atomic_store_explicit(&latch->state, LATCH_DONE, memory_order_relaxed);
+            i++;
+            break;
+        }
+    }
+    // Entries from i on were never registered. The last one visited may not
+    // have been either, but failing to unregister it is harmless.
+    latch->registered = i;
+    for (size_t j = i; j < park->n; j++) {
+        latch_release(latch);
+    }
+    int state = LATCH_REGISTERING;
+    return atomic_compare_exchange_strong_explicit(
+        &latch->state, &state, LATCH_PARKED, memory_order_acq_rel, memory_order_acquire
+    );
+}
+
+static bool park_on_latch(task_t *task, void *arg) {
+    (void) task;
+    return latch_register(arg);
+}
+
+/**
+ * @brief Waits on park until its latch reaches zero, then takes the latch
+ * back from handles that have not finished.
+ */
+static void latch_wait(tdata_t *tdata, latch_park *park) {
+    tpool_latch *latch = park->latch;
+    if (tdata) {
+        task_t *task = tdata->curr_task;
+        task->type = BLOCKED;
+        tdata->park = park_on_latch;
+        tdata->park_arg = park;
+        switch_to_scheduler(tdata, task);
+    } else if (latch_register(park)) {
+        wait_waiter(&latch->waiter);
+    }
+    for (size_t i = 0; i < latch->registered; i++) {
+        uintptr_t state = (uintptr_t) &latch->entries[i];
+        if (atomic_compare_exchange_strong_explicit(
+            &park->handles[i]->state, &state, WAITING, memory_order_acq_rel, memory_order_acquire
+        )) {
+            latch_release(latch);
+        }
+    }
+}
+
+/**
+ * @brief Waits for all n handles to finish, without releasing them.
+ */
+static void await_all(tpool_handle **handles, size_t n) {
+    tdata_t *tdata = get_tdata();
+    // the most recently spawned task is the least likely to have been stolen
+    for (size_t i = n; i > 0; i--) {
+        tdata = await_inline(tdata, handles[i - 1]);
+    }
+    size_t pending = 0;
+    for (size_t i = 0; i < n; i++) {
+        pending += !handle_finished(handles[i]);
+    }
+    if (pending > 0) {
+        latch_park park = {.latch = latch_alloc(tdata, n, n), .handles = handles, .n = n};
+        latch_wait(tdata, &park);
+        latch_release(park.latch);
+    }
+}
+
+void tpool_task_await_all(tpool_handle **handles, size_t n, void **results) {
+    await_all(handles, n);
+    for (size_t i = 0; i < n; i++) {
+        if (results != NULL) {
+            results[i] = handles[i]->result;
+        }
+        task_release(handles[i]->task);
+    }
+}
+
+void tpool_task_await_all_into(tpool_handle **handles, size_t n, void *results, size_t size) {
+    await_all(handles, n);
+    for (size_t i = 0; i < n; i++) {
+        memcpy((char *) results + i * size, handles[i]->result, size);
+        task_release(handles[i]->task);
+    }
+}
+
+/**
+ * @brief Waits for the first of n handles to finish, without releasing it.
+ * Returns its index.
+ */
+static size_t await_any(tpool_handle **handles, size_t n) {
+    ASSERT(n > 0 && "Awaiting any of no handles.");
+    size_t i;
+    for (i = 0; i < n && !handle_finished(handles[i]); i++) {}
+    if (i == n) {
+        tdata_t *tdata = get_tdata();
+        latch_park park = {.latch = latch_alloc(tdata, n, 1), .handles = handles, .n = n};
+        latch_wait(tdata, &park);
+        i = park.latch->last;
+        latch_release(park.latch);
+    }
+    return i;
+}
+
+void *tpool_task_await_any(tpool_handle **handles, size_t n, size_t *index) {
+    size_t i = await_any(handles, n);
+    void *result = handles[i]->result;
+    task_release(handles[i]->task);
+    if (index != NULL) {
+        *index = i;
+    }
+    return result;
+}
+
+void *tpool_task_await_any_into(tpool_handle **handles, size_t n, size_t *index, void *result, size_t size) {
+    size_t i = await_any(handles, n);
+    memcpy(result, handles[i]->result, size);
+    task_release(handles[i]->task);
+    if (index != NULL) {
+        *index = i;
+    }
+    return result;
+}
+
+/*
+ * A task or thread queued on a channel or lock. Lives on the waiter's stack
+ * and is unlinked by whoever wakes it.
+ */
+typedef struct wait_node {
+    tpool_waiter *waiter;
+    struct wait_node *next;
+} wait_node;
+
+/*
+ * FIFO of wait nodes, guarded by a lock of its owner.
+ */
+typedef struct wait_list {
+    wait_node *head;
+    wait_node **tail;
+    // waiters queued or about to be, read without the lock to skip the list
+    // when empty
+    _Atomic size_t count;
+} wait_list;
+
+static void wait_list_init(wait_list *list) {
+    list->head = NULL;
+    list->tail = &list->head;
+    atomic_init(&list->count, 0);
+}
+
+/**
+ * @brief Counts a waiter in before it rechecks whatever it waits for. The
+ * fence pairs with the one in wait_list_waiting, so either the waker sees
+ * the waiter counted, or the waiter sees the change and does not queue.
+ */
+static void wait_list_announce(wait_list *list) {
+    atomic_fetch_add_explicit(&list->count, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+/**
+ * @brief Counts out an announced waiter which did not queue after all.
+ */
+static void wait_list_retract(wait_list *list) {
+    atomic_fetch_sub_explicit(&list->count, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Queues an announced waiter.
+ */
+static void wait_list_push(wait_list *list, wait_node *node) {
+    node->next = NULL;
+    *list->tail = node;
+    list->tail = &node->next;
+}
+
+static wait_node *wait_list_pop(wait_list *list) {
+    wait_node *node = list->head;
+    if (node != NULL) {
+        list->head = node->next;
+        if (list->head == NULL) {
+            list->tail = &list->head;
+        }
+        atomic_fetch_sub_explicit(&list->count, 1, memory_order_relaxed);
+    }
+    return node;
+}
+
+/**
+ * @brief Whether a waiter may be queued, checked by a waker after making
+ * its change.
+ */
+static bool wait_list_waiting(wait_list *list) {
+    atomic_thread_fence(memory_order_seq_cst);
+    return atomic_load_explicit(&list->count, memory_order_relaxed) > 0;
+}
+
+/*
+ * Queues node on some object, unless the caller need not sleep after all.
+ * Returns false in that case.
+ */
+typedef bool (*enlist_fn)(void *object, wait_node *node);
+
+typedef struct list_park {
+    enlist_fn enlist;
+    void *object;
+    wait_node node;
+} list_park;
+
+static bool park_on_list(task_t *task, void *arg) {
+    list_park *park = arg;
+    park->node.waiter = &task->waiter;
+    return park->enlist(park->object, &park->node);
+}
+
+/**
+ * @brief Suspends the current task, or blocks the thread outside the pool,
+ * until woken through the node queued by enlist.
+ */
+static void list_wait(enlist_fn enlist, void *object) {
+    tdata_t *tdata = get_tdata();
+    list_park park = {.enlist = enlist, .object = object};
+    if (tdata) {
+        task_t *task = tdata->curr_task;
+        task->type = BLOCKED;
+        tdata->park = park_on_list;
+        tdata->park_arg = &park;
+        switch_to_scheduler(tdata, task);
+    } else {
+        tpool_waiter waiter = {.task = NULL};
+        atomic_init(&waiter.woken, 0);
+        park.node.waiter = &waiter;
+        if (enlist(object, &park.node)) {
+            wait_waiter(&waiter);
+        }
+    }
+}
+
+struct tpool_channel {
+    tpool_ring ring;
+    _Atomic bool closed;
+    // guards both lists; only taken when a side may have to park
+    pthread_mutex_t mutex;
+    wait_list senders;
+    wait_list receivers;
+};
+
+tpool_channel *tpool_channel_init(size_t capacity) {
+    if (capacity == 0) {
+        return NULL;
+    }
+    tpool_channel *channel = malloc(sizeof(tpool_channel));
+    if (channel == NULL) {
+        return NULL;
+    }
+    if (!tpool_ring_init(&channel->ring, capacity)) {
+        free(channel);
+        return NULL;
+    }
+    atomic_init(&channel->closed, false);
+    pthread_mutex_init(&channel->mutex, NULL);
+    wait_list_init(&channel->senders);
+    wait_list_init(&channel->receivers);
+    return channel;
+}
+
+void tpool_channel_free(tpool_channel *channel) {
+    ASSERT(channel->senders.head == NULL && channel->receivers.head == NULL
+        && "Channel freed while tasks wait on it.");
+    tpool_ring_free(&channel->ring);
+    pthread_mutex_destroy(&channel->mutex);
+    free(channel);
+}
+
+/**
+ * @brief Wakes up to count waiters of list after a change to the ring,
+ * taking the lock only if there may be any.
+ */
+static void channel_wake(tpool_channel *channel, wait_list *list, size_t count) {
+    if (!wait_list_waiting(list)) {
+        return;
+    }
+    wait_node *woken = NULL;
+    pthread_mutex_lock(&channel->mutex);
+    wait_node *node;
+    for (size_t i = 0; i < count && (node = wait_list_pop(list)) != NULL; i++) {
+        node->next = woken;
+        woken = node;
+    }
+    pthread_mutex_unlock(&channel->mutex);
+    while (woken != NULL) {
+        // the node is gone once its waiter runs
+        wait_node *next = woken->next;
+        wake_waiter(woken->waiter);
+        woken = next;
+    }
+}
+
+/**
+ * @brief Queues node as a sender or receiver, unless the ring changed so
+ * that it can make progress, or the channel was closed.
+ */
+static bool channel_enlist(tpool_channel *channel, wait_list *list, wait_node *node) {
+    pthread_mutex_lock(&channel->mutex);
+    wait_list_announce(list);
+    bool blocked = list == &channel->senders
+        ? tpool_ring_full(&channel->ring)
+        : tpool_ring_empty(&channel->ring);
+    if (blocked && !atomic_load_explicit(&channel->closed, memory_order_acquire)) {
+        wait_list_push(list, node);
+    } else {
+        wait_list_retract(list);
+        blocked = false;
+    }
+    pthread_mutex_unlock(&channel->mutex);
+    return blocked;
+}
+
+static bool enlist_sender(void *channel, wait_node *node) {
+    return channel_enlist(channel, &((tpool_channel *) channel)->senders, node);
+}
+
+static bool enlist_receiver(void *channel, wait_node *node) {
+    return channel_enlist(channel, &((tpool_channel *) channel)->receivers, node);
+}
+
+int tpool_channel_try_send(tpool_channel *channel, void *item) {
+    if (atomic_load_explicit(&channel->closed, memory_order_acquire)) {
+        errno = EPIPE;
+        return -1;
+    }
+    if (!tpool_ring_push(&channel->ring, item)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    channel_wake(channel, &channel->receivers, 1);
+    return 0;
+}
+
+int tpool_channel_send(tpool_channel *channel, void *item) {
+    while (tpool_channel_try_send(channel, item)) {
+        if (errno == EPIPE) {
+            return -1;
+        }
+        list_wait(enlist_sender, channel);
+    }
+    return 0;
+}
+
+size_t tpool_channel_try_recv_many(tpool_channel *channel, void **items, size_t max) {
+    size_t n = max == 1
+        ? tpool_ring_pop(&channel->ring, items)
+        : tpool_ring_pop_many(&channel->ring, items, max);
+    if (n > 0) {
+        channel_wake(channel, &channel->senders, n);
+    }
+    return n;
+}
+
+size_t tpool_channel_recv_many(tpool_channel *channel, void **items, size_t max) {
+    if (max == 0) {
+        return 0;
+    }
+    for (;;) {
+        size_t n = tpool_channel_try_recv_many(channel, items, max);
+        if (n > 0) {
+            return n;
+        }
+        if (atomic_load_explicit(&channel->closed, memory_order_acquire)) {
+            // items sent before the close are still delivered
+            return tpool_channel_try_recv_many(channel, items, max);
+        }
+        list_wait(enlist_receiver, channel);
+    }
+}
+
+int tpool_channel_try_recv(tpool_channel *channel, void **item) {
+    if (tpool_channel_try_recv_many(channel, item, 1)) {
+        return 0;
+    }
+    bool closed = atomic_load_explicit(&channel->closed, memory_order_acquire);
+    if (closed && tpool_channel_try_recv_many(channel, item, 1)) {
+        return 0;
+    }
+    errno = closed ? EPIPE : EAGAIN;
+    return -1;
+}
+
+int tpool_channel_recv(tpool_channel *channel, void **item) {
+    if (tpool_channel_recv_many(channel, item, 1)) {
+        return 0;
+    }
+    errno = EPIPE;
+    return -1;
+}
+
+void tpool_channel_close(tpool_channel *channel) {
+    atomic_store_explicit(&channel->closed, true, memory_order_release);
+    channel_wake(channel, &channel->senders, SIZE_MAX);
+    channel_wake(channel, &channel->receivers, SIZE_MAX);
+}
+
+enum {MUTEX_UNLOCKED, MUTEX_LOCKED, MUTEX_CONTENDED};
+
+struct tpool_mutex {
+    // MUTEX_CONTENDED while tasks may be queued, so that unlock checks
+    _Atomic int state;
+    pthread_mutex_t lock;
+    wait_list waiters;
+};
+
+tpool_mutex *tpool_mutex_init(void) {
+    tpool_mutex *mutex = malloc(sizeof(tpool_mutex));
+    if (mutex == NULL) {
+        return NULL;
+    }
+    atomic_init(&mutex->state, MUTEX_UNLOCKED);
+    pthread_mutex_init(&mutex->lock, NULL);
+    wait_list_init(&mutex->waiters);
+    return mutex;
+}
+
+void tpool_mutex_free(tpool_mutex *mutex) {
+    ASSERT(mutex->waiters.head == NULL && "Mutex freed while tasks wait on it.");
+    pthread_mutex_destroy(&mutex->lock);
+    free(mutex);
+}
+
+bool tpool_mutex_try_lock(tpool_mutex *mutex) {
+    int state = MUTEX_UNLOCKED;
+    return atomic_compare_exchange_strong_explicit(
+        &mutex->state, &state, MUTEX_LOCKED, memory_order_acquire, memory_order_relaxed
+    );
+}
+
+/**
+ * @brief Queues node for the mutex, or takes the mutex for it if it was
+ * unlocked in the meantime. Either way the waiter owns the mutex once it
+ * runs again.
+ */
+static bool mutex_enlist(void *object, wait_node *node) {
+    tpool_mutex *mutex = object;
+    pthread_mutex_lock(&mutex->lock);
+    bool queued = atomic_exchange_explicit(&mutex->state, MUTEX_CONTENDED, memory_order_acquire) != MUTEX_UNLOCKED;
+    if (queued) {
+        wait_list_announce(&mutex->waiters);
+        wait_list_push(&mutex->waiters, node);
+    }
+    pthread_mutex_unlock(&mutex->lock);
+    return queued;
+}
+
+void tpool_mutex_lock(tpool_mutex *mutex) {
+    for (int i = 0; i < TPOOL_LOCK_SPIN_COUNT; i++) {
+        if (atomic_load_explicit(&mutex->state, memory_order_relaxed) == MUTEX_UNLOCKED
+            && tpool_mutex_try_lock(mutex)) {
+            return;
+        }
+        cpu_relax();
+    }
+    list_wait(mutex_enlist, mutex);
+}
+
+void tpool_mutex_unlock(tpool_mutex *mutex) {
+    int state = MUTEX_LOCKED;
+    if (atomic_compare_exchange_strong_explicit(
+        &mutex->state, &state, MUTEX_UNLOCKED, memory_order_release, memory_order_relaxed
+    )) {
+        return;
+    }
+    pthread_mutex_lock(&mutex->lock);
+    wait_node *node = wait_list_pop(&mutex->waiters);
+    if (node == NULL) {
+        atomic_store_explicit(&mutex->state, MUTEX_UNLOCKED, memory_order_release);
+    } else if (mutex->waiters.head == NULL) {
+        // handed over, with nobody left to wake on the next unlock
+        atomic_store_explicit(&mutex->state, MUTEX_LOCKED, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&mutex->lock);
+    if (node != NULL) {
+        wake_waiter(node->waiter);
+    }
+}
+
+struct tpool_sem {
+    _Atomic size_t count;
+    pthread_mutex_t lock;
+    wait_list waiters;
+};
+
+tpool_sem *tpool_sem_init(size_t count) {
+    tpool_sem *sem = malloc(sizeof(tpool_sem));
+    if (sem == NULL) {
+        return NULL;
+    }
+    atomic_init(&sem->count, count);
+    pthread_mutex_init(&sem->lock, NULL);
+    wait_list_init(&sem->waiters);
+    return sem;
+}
+
+void tpool_sem_free(tpool_sem *sem) {
+    ASSERT(sem->waiters.head == NULL && "Semaphore freed while tasks wait on it.");
+    pthread_mutex_destroy(&sem->lock);
+    free(sem);
+}
+
+bool tpool_sem_try_wait(tpool_sem *sem) {
+    size_t count = atomic_load_explicit(&sem->count, memory_order_relaxed);
+    while (count > 0) {
+        if (atomic_compare_exchange_weak_explicit(
+            &sem->count, &count, count - 1, memory_order_acquire, memory_order_relaxed
+        )) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Queues node for the semaphore, or takes a unit for it if one was
+ * posted in the meantime. Either way the waiter holds a unit once it runs
+ * again.
+ */
+static bool sem_enlist(void *object, wait_node *node) {
+    tpool_sem *sem = object;
+    pthread_mutex_lock(&sem->lock);
+    wait_list_announce(&sem->waiters);
+    bool queued = !tpool_sem_try_wait(sem);
+    if (queued) {
+        wait_list_push(&sem->waiters, node);
+    } else {
+        wait_list_retract(&sem->waiters);
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return queued;
+}
+
+void tpool_sem_wait(tpool_sem *sem) {
+    for (int i = 0; i < TPOOL_LOCK_SPIN_COUNT; i++) {
+        if (tpool_sem_try_wait(sem)) {
+            return;
+        }
+        cpu_relax();
+    }
+    list_wait(sem_enlist, sem);
+}
+
+void tpool_sem_post(tpool_sem *sem) {
+    atomic_fetch_add_explicit(&sem->count, 1, memory_order_release);
+    if (!wait_list_waiting(&sem->waiters)) {
+        return;
+    }
+    // Hand the unit to the oldest waiter, unless somebody took it already.
+    pthread_mutex_lock(&sem->lock);
+    wait_node *node = NULL;
+    if (sem->waiters.head != NULL && tpool_sem_try_wait(sem)) {
+        node = wait_list_pop(&sem->waiters);
+    }
+    pthread_mutex_unlock(&sem->lock);
+    if (node != NULL) {
+        wake_waiter(node->waiter);
+    }
+}
+
+struct tpool_cond {
+    pthread_mutex_t lock;
+    wait_list waiters;
+    // the mutex the waiters hold, moved to once signaled
+    tpool_mutex *mutex;
+};
+
+tpool_cond *tpool_cond_init(void) {
+    tpool_cond *cond = malloc(sizeof(tpool_cond));
+    if (cond == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&cond->lock, NULL);
+    wait_list_init(&cond->waiters);
+    cond->mutex = NULL;
+    return cond;
+}
+
+void tpool_cond_free(tpool_cond *cond) {
+    ASSERT(cond->waiters.head == NULL && "Condition variable freed while tasks wait on it.");
+    pthread_mutex_destroy(&cond->lock);
+    free(cond);
+}
+
+typedef struct cond_park {
+    tpool_cond *cond;
+    tpool_mutex *mutex;
+} cond_park;
+
+/**
+ * @brief Queues node on the condition variable, then releases the mutex.
+ * Since the waiter is queued first, no signal sent after the release can
+ * be missed.
+ */
+static bool cond_enlist(void *object, wait_node *node) {
+    cond_park *park = object;
+    tpool_cond *cond = park->cond;
+    pthread_mutex_lock(&cond->lock);
+    ASSERT((cond->mutex == NULL || cond->mutex == park->mutex || cond->waiters.head == NULL)
+        && "Condition variable waited on with different mutexes.");
+    cond->mutex = park->mutex;
+    wait_list_announce(&cond->waiters);
+    wait_list_push(&cond->waiters, node);
+    pthread_mutex_unlock(&cond->lock);
+    tpool_mutex_unlock(park->mutex);
+    return true;
+}
+
+void tpool_cond_wait(tpool_cond *cond, tpool_mutex *mutex) {
+    cond_park park = {.cond = cond, .mutex = mutex};
+    list_wait(cond_enlist, &park);
+}
+
+/**
+ * @brief Wakes up to count waiters. Rather than waking them only to contend
+ * for the mutex, they are moved to its queue, and resumed one at a time as
+ * the mutex is handed to them.
+ */
+static void cond_wake(tpool_cond *cond, size_t count) {
+    if (!wait_list_waiting(&cond->waiters)) {
+        return;
+    }
+    wait_node *woken = NULL;
+    pthread_mutex_lock(&cond->lock);
+    tpool_mutex *mutex = cond->mutex;
+    wait_node *node;
+    for (size_t i = 0; i < count && (node = wait_list_pop(&cond->waiters)) != NULL; i++) {
+        node->next = woken;
+        woken = node;
+    }
+    pthread_mutex_unlock(&cond->lock);
+    // woken is newest first, so walk it back to front to keep them in order
+    wait_node *ordered = NULL;
+    while (woken != NULL) {
+        wait_node *next = woken->next;
+        woken->next = ordered;
+        ordered = woken;
+        woken = next;
+    }
+    while (ordered != NULL) {
+        wait_node *next = ordered->next;
+        if (!mutex_enlist(mutex, ordered)) {
+            wake_waiter(ordered->waiter);
+        }
+        ordered = next;
+    }
+}
+
+void tpool_cond_signal(tpool_cond *cond) {
+    cond_wake(cond, 1);
+}
+
+void tpool_cond_broadcast(tpool_cond *cond) {
+    cond_wake(cond, SIZE_MAX);
+}
+
+static void task_handle_init(tpool_handle *handle, task_t *task) {
+    handle->result = NULL;
+    atomic_init(&handle->state, WAITING);
+    handle->task = task;
+}
+
+/**
+ * @brief Allocates a task_record or detached_record of size bytes, including
+ * its argument, and returns the task it starts with. Pool threads allocate
+ * from their own slab, other threads share one.
+ */
+static void *record_alloc(tpool_slab *slab, size_t size) {
+    task_t *task = tpool_slab_alloc(slab, size);
+    if (task != NULL) {
+        task->slab = true;
+        return task;
+    }
+    task = malloc(size);
+    ASSERT(task != NULL && "Allocation failed in task_record_alloc.");
+    task->slab = false;
+    return task;
+}
+
+static void *task_record_alloc(tpool_pool *pool, size_t size) {
+    tdata_t *tdata = get_tdata();
+    if (tdata != NULL && tdata->pool == pool) {
+        return record_alloc(&tdata->worker->slab, size);
+    }
+    pthread_mutex_lock(&pool->shared_slab_mutex);
+    void *record = record_alloc(&pool->shared_slab, size);
+    pthread_mutex_unlock(&pool->shared_slab_mutex);
+    return record;
+}
+
+/**
+ * @brief Initializes task, detached unless it has a handle.
+ */
+static void task_init(
+    tpool_pool *pool, task_t *task, tpool_work work, void *arg, tpool_task_attr attr, tpool_handle *handle
+) {
+    task->type = INITIAL;
+    atomic_init(&task->started, false);
+    task->prio = attr.prio;
+    task->stack_class = attr.stack;
+    task->detached = handle == NULL;
+    atomic_init(&task->refs, handle != NULL ? 2 : 1);
+    task->work = work;
+    task->arg = arg;
+    task->pool = pool;
+    task->waiter.task = task;
+    task->waiter.latch = NULL;
+    atomic_init(&task->waiter.woken, 0);
+    task->handle = handle;
+    if (handle != NULL) {
+        task_handle_init(handle, task);
+    }
+}
+
+static void count_spawned(tpool_pool *pool, tdata_t *tdata, uint64_t count) {
+    if (tdata != NULL && tdata->pool == pool) {
+        counter_add(&tdata->worker->counters.spawned, count);
+    } else {
+        atomic_fetch_add_explicit(&pool->external_spawned, count, memory_order_relaxed);
+    }
+}
+
+static tpool_handle *task_submit(
+    tpool_pool *pool, task_t *task, tpool_work work, void *arg, tpool_task_attr attr, tpool_handle *handle
+) {
+    ASSERT(attr.prio < TPOOL_PRIO_LEVELS && "Invalid task priority.");
+    ASSERT(attr.stack < TPOOL_STACK_CLASSES && "Invalid task stack class.");
+    task_init(pool, task, work, arg, attr, handle);
+
+    // counted before it becomes runnable so the count cannot transiently hit
+    // 0, which also makes tpool_close wait for detached tasks
+    modify_task_count(pool, 1);
+    tdata_t *tdata = get_tdata();
+    count_spawned(pool, tdata, 1);
+    if (tdata != NULL) {
+        TRACE(tdata, TPOOL_TRACE_SPAWN, task);
+    }
+
+    schedule_task(pool, task);
+
+    return task->handle;
+}
+
+tpool_handle *tpool_task_enqueue(tpool_pool *pool, tpool_work work, void *arg) {
+    return tpool_task_enqueue_prio(pool, work, arg, TPOOL_PRIO_NORMAL);
+}
+
+tpool_handle *tpool_task_enqueue_prio(tpool_pool *pool, tpool_work work, void *arg, tpool_priority prio) {
+    return tpool_task_enqueue_attr(pool, work, arg, (tpool_task_attr) {.prio = prio});
+}
+
+tpool_handle *tpool_task_enqueue_attr(tpool_pool *pool, tpool_work work, void *arg, tpool_task_attr attr) {
+    task_record *record = task_record_alloc(pool, sizeof(task_record));
+    return task_submit(pool, &record->task, work, arg, attr, &record->handle);
+}
+
+tpool_handle *tpool_task_enqueue_copy(tpool_pool *pool, tpool_work work, const void *arg, size_t size) {
+    return tpool_task_enqueue_copy_prio(pool, work, arg, size, TPOOL_PRIO_NORMAL);
+}
+
+tpool_handle *tpool_task_enqueue_copy_prio(
+    tpool_pool *pool, tpool_work work, const void *arg, size_t size, tpool_priority prio
+) {
+    return tpool_task_enqueue_copy_attr(pool, work, arg, size, (tpool_task_attr) {.prio = prio});
+}
+
+tpool_handle *tpool_task_enqueue_copy_attr(
+    tpool_pool *pool, tpool_work work, const void *arg, size_t size, tpool_task_attr attr
+) {
+    task_record *record = task_record_alloc(pool, sizeof(task_record) + size);
+    memcpy(record->args, arg, size);
+    return task_submit(pool, &record->task, work, record->args, attr, &record->handle);
+}
+
+void tpool_task_spawn_detached(tpool_pool *pool, tpool_work work, void *arg) {
+    tpool_task_spawn_detached_attr(pool, work, arg, (tpool_task_attr) {0});
+}
+
+void tpool_task_spawn_detached_attr(tpool_pool *pool, tpool_work work, void *arg, tpool_task_attr attr) {
+    detached_record *record = task_record_alloc(pool, sizeof(detached_record));
+    task_submit(pool, &record->task, work, arg, attr, NULL);
+}
+
+void tpool_task_spawn_detached_copy(
+    tpool_pool *pool, tpool_work work, const void *arg, size_t size, tpool_task_attr attr
+) {
+    detached_record *record = task_record_alloc(pool, sizeof(detached_record) + size);
+    memcpy(record->args, arg, size);
+    task_submit(pool, &record->task, work, record->args, attr, NULL);
+}
+
+void tpool_task_enqueue_batch(tpool_pool *pool, tpool_work work, void **args, size_t count, tpool_handle **handles) {
+    if (count == 0) {
+        return;
+    }
+    tdata_t *tdata = get_tdata();
+    bool local = tdata != NULL && tdata->pool == pool;
+    tpool_slab *slab = local ? &tdata->worker->slab : &pool->shared_slab;
+    if (!local) {
+        pthread_mutex_lock(&pool->shared_slab_mutex);
+    }
+    for (size_t i = 0; i < count; i++) {
+        task_record *record = record_alloc(slab, sizeof(task_record));
+        task_init(pool, &record->task, work, args[i], (tpool_task_attr) {0}, &record->handle);
+        handles[i] = &record->handle;
+    }
+    if (!local) {
+        pthread_mutex_unlock(&pool->shared_slab_mutex);
+    }
+
+    modify_task_count(pool, count);
+    count_spawned(pool, tdata, count);
+    if (tdata != NULL && __builtin_expect(tdata->trace != NULL, 0)) {
+        for (size_t i = 0; i < count; i++) {
+            tpool_trace_record(tdata->trace, TPOOL_TRACE_SPAWN, handles[i]->task);
+        }
+    }
+    if (local) {
+        tpool_lane *lane = &tdata->worker->lanes[TPOOL_PRIO_NORMAL];
+        for (size_t i = 0; i < count; i++) {
+            lane_push(tdata->worker, lane, &lane->deque, handles[i]->task);
+        }
+    } else {
+        void **entries = malloc(count * sizeof(void *));
+        ASSERT(entries != NULL && "Allocation failed in tpool_task_enqueue_batch.");
+        uint32_t tick = ready_tick();
+        for (size_t i = 0; i < count; i++) {
+            handles[i]->task->timed = true;
+            handles[i]->task->ready_tick = tick;
+            entries[i] = handles[i]->task;
+        }
+        atomic_fetch_add_explicit(&pool->injected[TPOOL_PRIO_NORMAL], count, memory_order_relaxed);
+        tpool_enqueue_many(pool->task_queues[TPOOL_PRIO_NORMAL], entries, count);
+        free(entries);
+    }
+    // the woken worker wakes another once it finds work, if there is more
+    notify_worker(pool);
+}
+
+typedef struct range_job {
+    size_t begin;
+    size_t end;
+    size_t grain;
+    tpool_range_body body;
+    void *arg;
+} range_job;
+
+/**
+ * @brief Whether a worker is looking for work while the current one has
+ * nothing queued for it to steal.
+ */
+static bool worker_starving(tpool_pool *pool, tdata_t *tdata) {
+    return tpool_deque_size(&tdata->worker->lanes[tdata->curr_task->prio].deque) == 0
+        && (atomic_load_explicit(&pool->searching, memory_order_relaxed) > 0
+            || tpool_eventcount_has_waiters(&pool->idle));
+}
+
+static void *range_task(void *arg);
+
+/**
+ * @brief Runs job a grain at a time, handing off the upper half of what is
+ * left whenever another worker could take it.
+ */
+static void run_range(tpool_pool *pool, range_job job) {
+    // each split halves the range, so this many cannot be exceeded
+    tpool_handle *splits[sizeof(size_t) * 8];
+    size_t split_count = 0;
+    while (job.end - job.begin > job.grain) {
+        if (worker_starving(pool, get_tdata())) {
+            range_job upper = job;
+            upper.begin = job.begin + (job.end - job.begin) / 2;
+            job.end = upper.begin;
+            task_t *curr = get_tdata()->curr_task;
+            splits[split_count++] = tpool_task_enqueue_copy_attr(pool, range_task, &upper, sizeof(upper),
+                (tpool_task_attr) {.prio = curr->prio, .stack = curr->stack_class});
+        } else {
+            job.body(job.begin, job.begin + job.grain, job.arg);
+            job.begin += job.grain;
+        }
+    }
+    if (job.begin < job.end) {
+        job.body(job.begin, job.end, job.arg);
+    }
+    while (split_count > 0) {
+        tpool_task_await(splits[--split_count]);
+    }
+}
+
+static void *range_task(void *arg) {
+    run_range(get_tdata()->pool, *(range_job *) arg);
+    return NULL;
+}
+
+void tpool_parallel_for(
+    tpool_pool *pool, size_t begin, size_t end, size_t grain, tpool_range_body body, void *arg
+) {
+    if (begin >= end) {
+        return;
+    }
+    range_job job = {
+        .begin = begin,
+        .end = end,
+        .grain = grain ? grain : 1,
+        .body = body,
+        .arg = arg
+    };
+    tdata_t *tdata = get_tdata();
+    if (tdata != NULL && tdata->pool == pool) {
+        run_range(pool, job);
+    } else {
+        tpool_task_await(tpool_task_enqueue_copy(pool, range_task, &job, sizeof(job)));
+    }
+}
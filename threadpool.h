@@ -1,28 +1,194 @@
 #include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 #include "queue.h"
+#include "stack.h"
 
 typedef struct tpool_handle tpool_handle;
 typedef struct tpool_pool tpool_pool;
+typedef struct tpool_channel tpool_channel;
+typedef struct tpool_mutex tpool_mutex;
+typedef struct tpool_sem tpool_sem;
+typedef struct tpool_cond tpool_cond;
 typedef void *(*tpool_work)(void *);
+typedef void (*tpool_range_body)(size_t begin, size_t end, void *arg);
 
 /**
- * Initializes the pool size threads. 0 for default.
+ * Scheduling classes. Each has its own queues, and workers take work from
+ * the highest class that has any, except that every so often a lower class
+ * goes first so that it cannot starve. NORMAL is zero, so that zeroed
+ * attributes select it.
+ */
+typedef enum tpool_priority {
+    TPOOL_PRIO_NORMAL,
+    TPOOL_PRIO_HIGH,
+    TPOOL_PRIO_LOW,
+    TPOOL_PRIO_LEVELS
+} tpool_priority;
+
+/**
+ * Task stack sizes. A task starts on a stack of its class, so that tasks
+ * which suspend hold no more stack than they need. Default class tasks
+ * start on any stack of at least the default size.
+ */
+typedef enum tpool_stack_class {
+    TPOOL_STACK_DEFAULT,
+    TPOOL_STACK_SMALL,
+    TPOOL_STACK_LARGE,
+    TPOOL_STACK_CLASSES
+} tpool_stack_class;
+
+/**
+ * How a task is run: its scheduling class and stack class. Zeroed, it
+ * runs a task like tpool_task_enqueue does.
+ */
+typedef struct tpool_task_attr {
+    tpool_priority prio;
+    tpool_stack_class stack;
+} tpool_task_attr;
+
+/**
+ * Queue counters of one scheduling class.
+ */
+typedef struct tpool_lane_stats {
+    // queue entries not taken yet
+    uint64_t depth;
+    // queue entries taken, including those of tasks already run by their
+    // awaiter
+    uint64_t taken;
+    // mean and longest time tasks spent runnable before they ran, over a
+    // sample of the tasks
+    uint64_t mean_wait_ns;
+    uint64_t max_wait_ns;
+} tpool_lane_stats;
+
+/**
+ * Scheduler counters of one worker, or of the whole pool.
+ */
+typedef struct tpool_worker_stats {
+    // tasks spawned from the worker, and tasks it finished
+    uint64_t spawned;
+    uint64_t completed;
+    // suspended tasks it resumed, and tasks which yielded or parked on it
+    uint64_t resumed;
+    uint64_t yielded;
+    uint64_t parked;
+    // queues it tried to steal from, and steals which got a task
+    uint64_t steal_attempts;
+    uint64_t steals;
+    // time spent looking for work or asleep
+    uint64_t idle_ns;
+    // most entries one of its queues held at once
+    uint64_t max_queue_depth;
+    // task stacks taken from its cache, and stacks it had to map
+    uint64_t stack_hits;
+    uint64_t stack_misses;
+} tpool_worker_stats;
+
+/**
+ * Snapshot of the state and counters of a pool.
+ */
+typedef struct tpool_stats {
+    // worker threads running, including extra ones
+    size_t workers;
+    // workers in blocking regions
+    size_t blocking;
+    // tasks spawned and not finished yet
+    size_t tasks;
+    // the counters summed over every worker that ever ran, with the largest
+    // max_queue_depth of any; spawned includes tasks spawned from outside
+    // the pool
+    tpool_worker_stats total;
+} tpool_stats;
+
+/**
+ * Stack use of one task function, measured while stack profiling.
+ */
+typedef struct tpool_stack_usage {
+    tpool_work work;
+    // tasks of it which finished, and the most stack any of them used, in
+    // bytes, 0 if no more than TPOOL_STACK_PROFILE_FLOOR
+    uint64_t runs;
+    uint64_t max_bytes;
+} tpool_stack_usage;
+
+/**
+ * Bytes below the frame a task starts from that stack profiling cannot
+ * measure, since painting the stack runs there.
+ */
+#define TPOOL_STACK_PROFILE_FLOOR 512
+
+/**
+ * Pool configuration. Zeroed fields select the default.
+ */
+typedef struct tpool_config {
+    // number of worker threads
+    size_t size;
+    // usable bytes per task stack of each class, rounded up to whole pages
+    size_t stack_size;
+    size_t small_stack_size;
+    size_t large_stack_size;
+    // stacks each worker keeps resident per class; as many more are kept
+    // mapped with their memory given back, and further ones are unmapped
+    size_t stack_cache_size;
+    // pin each worker to its own CPU, filling one NUMA node before the next,
+    // so that workers steal from their own node first and keep their stacks
+    // and task records in its memory
+    bool pin;
+    // CPUs the workers may run on, which keeps pools from competing for the
+    // same cores; NULL for any the process may run on. size defaults to
+    // their number, and pin picks among them
+    const int *cpus;
+    size_t cpu_count;
+    // niceness of the worker threads, as for setpriority(2); 0 leaves it as
+    // inherited. Lowering it usually needs privileges
+    int nice;
+    // upper bound on workers, counting extra ones started in place of those
+    // in blocking regions; size is the lower bound
+    size_t max_size;
+    // nanoseconds an extra worker may sit idle before it exits
+    uint64_t idle_timeout_ns;
+    // latest scheduler events each worker keeps for tpool_trace_dump; 0
+    // disables tracing
+    size_t trace_events;
+    // paint task stacks to measure how much of them each task function
+    // uses, for tpool_get_stack_profile; slows down every task
+    bool stack_profile;
+} tpool_config;
+
+/**
+ * Initializes the pool size threads. 0 for one per CPU the process may run
+ * on.
  * Returns NULL on failure.
  */
 tpool_pool *tpool_init(size_t size);
 
+/**
+ * Initializes the pool from config.
+ * Returns NULL on failure.
+ */
+tpool_pool *tpool_init_config(const tpool_config *config);
+
+/**
+ * Returns the pool the calling thread works for, NULL outside of any pool.
+ */
+tpool_pool *tpool_current_pool(void);
+
 /**
  * Closes pool by joining threads and freeing all allocated memory.
  * Waits until all workers are waiting for tasks, then exits.
  * May never return if tasks add other tasks.
  * Behavior is unspecified if tasks are added while this is running.
+ * Task records are freed with the pool, so awaiting a handle of one of its
+ * tasks afterwards, even from another pool, is undefined.
  */
 void tpool_close(tpool_pool *pool);
 
 /**
  * @brief Yields execution to the threadpool, enqueueing a resume task so that
  * the threadpool can resume execution of the current task eventually.
+ * Returns right away if no other task is runnable.
  *
  * Assumes the calling thread is a threadpool thread.
  *
@@ -30,12 +196,339 @@ void tpool_close(tpool_pool *pool);
  */
 void tpool_yield();
 
+/**
+ * Suspends the current task until fd may be readable, or writable if write
+ * is set. Readiness is edge-triggered, so callers should only wait after an
+ * operation on fd failed with EAGAIN.
+ *
+ * Blocks the thread when called from outside the pool.
+ * Returns 0, or -1 with errno set if fd cannot be waited on.
+ */
+int tpool_wait_fd(int fd, bool write);
+
 /**
  * Gets the result of a future.
  */
 void *tpool_task_await(tpool_handle *handle);
 
+/**
+ * Waits for handle like tpool_task_await, for a task whose result points to
+ * size bytes, and copies them to result before the handle is released.
+ * Returns result.
+ */
+void *tpool_task_await_into(tpool_handle *handle, void *result, size_t size);
+
+/**
+ * Gets the results of n futures, storing them in results if not NULL. The
+ * caller is resumed once, when the last of them finishes.
+ */
+void tpool_task_await_all(tpool_handle **handles, size_t n, void **results);
+
+/**
+ * Waits for n futures like tpool_task_await_all, for tasks whose results
+ * point to size bytes, and copies them to the n consecutive elements of
+ * results.
+ */
+void tpool_task_await_all_into(tpool_handle **handles, size_t n, void *results, size_t size);
+
+/**
+ * Waits until any of n futures finishes and returns its result, storing its
+ * index in index if not NULL. The other handles must still be awaited.
+ */
+void *tpool_task_await_any(tpool_handle **handles, size_t n, size_t *index);
+
+/**
+ * Waits like tpool_task_await_any, for tasks whose results point to size
+ * bytes, and copies the result to result. Returns result.
+ */
+void *tpool_task_await_any_into(tpool_handle **handles, size_t n, size_t *index, void *result, size_t size);
+
+/**
+ * Waits for handle like tpool_task_await, giving up at deadline, in
+ * CLOCK_MONOTONIC nanoseconds. On success stores the result in result, if
+ * not NULL, and returns true. On timeout returns false and the handle must
+ * still be awaited.
+ */
+bool tpool_task_await_until(tpool_handle *handle, uint64_t deadline, void **result);
+
+/**
+ * Waits like tpool_task_await_until, for a task whose result points to size
+ * bytes, and copies them to result on success.
+ */
+bool tpool_task_await_until_into(tpool_handle *handle, uint64_t deadline, void *result, size_t size);
+
+/**
+ * Suspends the current task until deadline, in CLOCK_MONOTONIC nanoseconds.
+ * Blocks the thread when called from outside the pool.
+ */
+void tpool_sleep_until(uint64_t deadline);
+
+/**
+ * Calls work on arg as a blocking region: while it runs, the pool may start
+ * an extra worker if tasks are queued and no other worker is free, so that a
+ * blocking system call does not hold up the pool. Extra workers exit after
+ * the configured idle timeout.
+ *
+ * Simply calls work when called from outside the pool.
+ */
+void *tpool_blocking(tpool_work work, void *arg);
+
+/**
+ * Creates a channel buffering up to capacity items, which must be at least
+ * 1. Returns NULL on failure.
+ */
+tpool_channel *tpool_channel_init(size_t capacity);
+
+/**
+ * Frees channel. No task may be waiting on it.
+ */
+void tpool_channel_free(tpool_channel *channel);
+
+/**
+ * Sends item, suspending the current task while the channel is full.
+ * Blocks the thread when called from outside the pool.
+ * Returns 0, or -1 with errno set to EPIPE if the channel is closed.
+ */
+int tpool_channel_send(tpool_channel *channel, void *item);
+
+/**
+ * Sends item if there is room. Returns 0, or -1 with errno set to EAGAIN if
+ * the channel is full or EPIPE if it is closed.
+ */
+int tpool_channel_try_send(tpool_channel *channel, void *item);
+
+/**
+ * Receives the oldest item, suspending the current task while the channel
+ * is empty. Returns 0, or -1 with errno set to EPIPE once the channel is
+ * closed and drained.
+ */
+int tpool_channel_recv(tpool_channel *channel, void **item);
+
+/**
+ * Receives the oldest item if there is one. Returns 0, or -1 with errno set
+ * to EAGAIN if the channel is empty or EPIPE if it is closed and drained.
+ */
+int tpool_channel_try_recv(tpool_channel *channel, void **item);
+
+/**
+ * Receives up to max items at once, suspending while the channel is empty.
+ * Returns the number received, 0 once the channel is closed and drained.
+ */
+size_t tpool_channel_recv_many(tpool_channel *channel, void **items, size_t max);
+
+/**
+ * Receives up to max items without waiting. Returns the number received.
+ */
+size_t tpool_channel_try_recv_many(tpool_channel *channel, void **items, size_t max);
+
+/**
+ * Closes channel, waking every waiting task. Further sends fail, while the
+ * items already sent can still be received.
+ */
+void tpool_channel_close(tpool_channel *channel);
+
+/**
+ * Creates an unlocked mutex for tasks. Returns NULL on failure.
+ *
+ * Contended lockers spin briefly, then suspend, so waiting tasks do not
+ * hold up their workers. Unlock hands the mutex to the oldest waiter.
+ */
+tpool_mutex *tpool_mutex_init(void);
+
+/**
+ * Frees mutex. No task may be waiting on it.
+ */
+void tpool_mutex_free(tpool_mutex *mutex);
+
+/**
+ * Locks mutex, suspending the current task while it is held.
+ * Blocks the thread when called from outside the pool.
+ */
+void tpool_mutex_lock(tpool_mutex *mutex);
+
+/**
+ * Locks mutex if it is free. Returns whether it was locked.
+ */
+bool tpool_mutex_try_lock(tpool_mutex *mutex);
+
+void tpool_mutex_unlock(tpool_mutex *mutex);
+
+/**
+ * Creates a counting semaphore for tasks holding count units. Returns NULL
+ * on failure.
+ */
+tpool_sem *tpool_sem_init(size_t count);
+
+/**
+ * Frees sem. No task may be waiting on it.
+ */
+void tpool_sem_free(tpool_sem *sem);
+
+/**
+ * Takes a unit, suspending the current task while there are none.
+ * Blocks the thread when called from outside the pool.
+ */
+void tpool_sem_wait(tpool_sem *sem);
+
+/**
+ * Takes a unit if there is one. Returns whether it took one.
+ */
+bool tpool_sem_try_wait(tpool_sem *sem);
+
+/**
+ * Adds a unit, handing it to the oldest waiter if there is one.
+ */
+void tpool_sem_post(tpool_sem *sem);
+
+/**
+ * Creates a condition variable for tasks. Returns NULL on failure.
+ */
+tpool_cond *tpool_cond_init(void);
+
+/**
+ * Frees cond. No task may be waiting on it.
+ */
+void tpool_cond_free(tpool_cond *cond);
+
+/**
+ * Releases mutex, which must be held, and suspends the current task until
+ * signaled. Returns with mutex held again. Every concurrent waiter must use
+ * the same mutex. There are no spurious wakeups, but the condition should
+ * still be rechecked since others may run first.
+ */
+void tpool_cond_wait(tpool_cond *cond, tpool_mutex *mutex);
+
+/**
+ * Wakes the oldest waiter, if any.
+ */
+void tpool_cond_signal(tpool_cond *cond);
+
+/**
+ * Wakes every waiter. They are resumed one at a time as each gets the mutex.
+ */
+void tpool_cond_broadcast(tpool_cond *cond);
+
+/**
+ * Reads the queue counters of each scheduling class, summed over all
+ * workers. Wait times are measured to about a microsecond.
+ */
+void tpool_get_lane_stats(tpool_pool *pool, tpool_lane_stats stats[TPOOL_PRIO_LEVELS]);
+
+/**
+ * Reads the counters of every worker that ever ran, including extra workers
+ * which have exited, into stats, up to max of them. Returns the number of
+ * workers, which may exceed max.
+ *
+ * Each counter is written by its worker alone and read without stopping it,
+ * so counters are individually up to date but not consistent with each
+ * other.
+ */
+size_t tpool_get_worker_stats(tpool_pool *pool, tpool_worker_stats *stats, size_t max);
+
+/**
+ * Reads the state of pool and sums the counters of its workers.
+ */
+void tpool_stats_snapshot(tpool_pool *pool, tpool_stats *stats);
+
+/**
+ * Writes the latest scheduler events of every worker to the file at path as
+ * Chrome trace-event JSON, which Perfetto and chrome://tracing load. The
+ * pool must have been created with trace_events set, and should be idle so
+ * that no events are recorded while the dump runs.
+ *
+ * Returns 0, or -1 with errno set, to EINVAL if tracing is off.
+ */
+int tpool_trace_dump(tpool_pool *pool, const char *path);
+
+/**
+ * Sums the stack cache counters of every worker into stats.
+ */
+void tpool_get_stack_stats(tpool_pool *pool, tpool_stack_stats *stats);
+
+/**
+ * Reads the deepest stack use of each task function measured so far, up to
+ * max of them, deepest first. The pool must have been created with
+ * stack_profile set. Returns the number of functions stored.
+ *
+ * A task that runs what it awaits inline is charged for the stack those
+ * tasks use too, and tasks run inline may be charged for what the task
+ * beneath them used earlier, so uses are overestimated. Uses of at most
+ * TPOOL_STACK_PROFILE_FLOOR bytes cannot be told apart and read as 0.
+ */
+size_t tpool_get_stack_profile(tpool_pool *pool, tpool_stack_usage *usage, size_t max);
+
 /**
  * Enqueues a task with a task handle which can awaited.
  */
-tpool_handle *tpool_task_enqueue(tpool_pool *pool, tpool_work work, void *arg);
\ No newline at end of file
+tpool_handle *tpool_task_enqueue(tpool_pool *pool, tpool_work work, void *arg);
+
+/**
+ * Enqueues a task like tpool_task_enqueue, in scheduling class prio rather
+ * than TPOOL_PRIO_NORMAL.
+ */
+tpool_handle *tpool_task_enqueue_prio(tpool_pool *pool, tpool_work work, void *arg, tpool_priority prio);
+
+/**
+ * Enqueues a task like tpool_task_enqueue, with a copy of the size bytes at
+ * arg stored alongside the task. work receives a pointer to the copy, which
+ * lives until the handle has been awaited.
+ */
+tpool_handle *tpool_task_enqueue_copy(tpool_pool *pool, tpool_work work, const void *arg, size_t size);
+
+/**
+ * Enqueues a task like tpool_task_enqueue_copy, in scheduling class prio.
+ */
+tpool_handle *tpool_task_enqueue_copy_prio(
+    tpool_pool *pool, tpool_work work, const void *arg, size_t size, tpool_priority prio
+);
+
+/**
+ * Enqueues a task like tpool_task_enqueue, run as attr describes.
+ */
+tpool_handle *tpool_task_enqueue_attr(tpool_pool *pool, tpool_work work, void *arg, tpool_task_attr attr);
+
+/**
+ * Enqueues a task like tpool_task_enqueue_copy, run as attr describes.
+ */
+tpool_handle *tpool_task_enqueue_copy_attr(
+    tpool_pool *pool, tpool_work work, const void *arg, size_t size, tpool_task_attr attr
+);
+
+/**
+ * Enqueues a task without a handle, for work whose result nobody reads. The
+ * task is freed once it finishes and its result is dropped. tpool_close
+ * still waits for it.
+ */
+void tpool_task_spawn_detached(tpool_pool *pool, tpool_work work, void *arg);
+
+/**
+ * Enqueues a detached task like tpool_task_spawn_detached, run as attr
+ * describes.
+ */
+void tpool_task_spawn_detached_attr(tpool_pool *pool, tpool_work work, void *arg, tpool_task_attr attr);
+
+/**
+ * Enqueues a detached task like tpool_task_spawn_detached, on a copy of the
+ * size bytes at arg and run as attr describes.
+ */
+void tpool_task_spawn_detached_copy(
+    tpool_pool *pool, tpool_work work, const void *arg, size_t size, tpool_task_attr attr
+);
+
+/**
+ * Enqueues count tasks running work on each of args, storing their handles
+ * in handles. The tasks are counted and made runnable all at once.
+ */
+void tpool_task_enqueue_batch(tpool_pool *pool, tpool_work work, void **args, size_t count, tpool_handle **handles);
+
+/**
+ * Calls body on consecutive subranges of [begin, end) of about grain
+ * elements, in parallel, and returns once all calls have returned. Tasks
+ * split off run in the scheduling and stack class of the caller.
+ *
+ * The range is only split when another worker is idle, so the number of
+ * tasks created adapts to the load rather than the size of the range.
+ */
+void tpool_parallel_for(
+    tpool_pool *pool, size_t begin, size_t end, size_t grain, tpool_range_body body, void *arg
+);
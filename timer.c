@@ -0,0 +1,133 @@
+#include <time.h>
+
+#include "timer.h"
+
+#define SLOT_BITS 6
+
+uint64_t tpool_timer_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+void tpool_timer_wheel_init(tpool_timer_wheel *wheel, uint64_t now) {
+    wheel->now = now >> TPOOL_TIMER_TICK_SHIFT;
+    wheel->count = 0;
+    for (size_t level = 0; level < TPOOL_TIMER_LEVELS; level++) {
+        wheel->occupied[level] = 0;
+        for (size_t slot = 0; slot < TPOOL_TIMER_SLOTS; slot++) {
+            wheel->slots[level][slot] = NULL;
+        }
+    }
+}
+
+static void place(tpool_timer_wheel *wheel, tpool_timer *timer) {
+    // the highest bit in which the tick differs from now picks the level
+    unsigned level = (63 - __builtin_clzll(timer->tick ^ wheel->now)) / SLOT_BITS;
+    unsigned slot = (timer->tick >> (level * SLOT_BITS)) % TPOOL_TIMER_SLOTS;
+    tpool_timer **head = &wheel->slots[level][slot];
+    timer->level = level;
+    timer->slot = slot;
+    timer->next = *head;
+    timer->prev = head;
+    if (*head != NULL) {
+        (*head)->prev = &timer->next;
+    }
+    *head = timer;
+    wheel->occupied[level] |= (uint64_t) 1 << slot;
+}
+
+bool tpool_timer_add(tpool_timer_wheel *wheel, tpool_timer *timer) {
+    // round up so that timers never fire early
+    timer->tick = (timer->deadline + (1 << TPOOL_TIMER_TICK_SHIFT) - 1) >> TPOOL_TIMER_TICK_SHIFT;
+    if (timer->tick <= wheel->now) {
+        timer->prev = NULL;
+        return false;
+    }
+    place(wheel, timer);
+    wheel->count++;
+    return true;
+}
+
+static void unlink_timer(tpool_timer_wheel *wheel, tpool_timer *timer) {
+    *timer->prev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+    if (wheel->slots[timer->level][timer->slot] == NULL) {
+        wheel->occupied[timer->level] &= ~((uint64_t) 1 << timer->slot);
+    }
+    timer->prev = NULL;
+}
+
+void tpool_timer_remove(tpool_timer_wheel *wheel, tpool_timer *timer) {
+    if (tpool_timer_pending(timer)) {
+        unlink_timer(wheel, timer);
+        wheel->count--;
+    }
+}
+
+/**
+ * Finds the occupied slot which the wheel reaches first, and the tick at
+ * which it does. Returns false if the wheel is empty.
+ */
+static bool next_slot(const tpool_timer_wheel *wheel, unsigned *level_out, unsigned *slot_out, uint64_t *tick_out) {
+    bool found = false;
+    for (unsigned level = 0; level < TPOOL_TIMER_LEVELS; level++) {
+        unsigned shift = level * SLOT_BITS;
+        unsigned current = (wheel->now >> shift) % TPOOL_TIMER_SLOTS;
+        // slots behind the current one are only reused after moving up a
+        // level, so they are empty
+        uint64_t ahead = wheel->occupied[level] & (~(uint64_t) 0 << current);
+        if (ahead == 0) {
+            continue;
+        }
+        unsigned slot = __builtin_ctzll(ahead);
+        uint64_t span = shift + SLOT_BITS < 64 ? (uint64_t) 1 << (shift + SLOT_BITS) : 0;
+        uint64_t tick = (wheel->now & -span) + ((uint64_t) slot << shift);
+        if (!found || tick < *tick_out) {
+            *level_out = level;
+            *slot_out = slot;
+            *tick_out = tick;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void tpool_timer_wheel_advance(tpool_timer_wheel *wheel, uint64_t now) {
+    uint64_t target = now >> TPOOL_TIMER_TICK_SHIFT;
+    unsigned level = 0, slot = 0;
+    uint64_t tick = 0;
+    while (next_slot(wheel, &level, &slot, &tick) && tick <= target) {
+        if (tick > wheel->now) {
+            wheel->now = tick;
+        }
+        tpool_timer *timer = wheel->slots[level][slot];
+        wheel->slots[level][slot] = NULL;
+        wheel->occupied[level] &= ~((uint64_t) 1 << slot);
+        while (timer != NULL) {
+            tpool_timer *next = timer->next;
+            if (timer->tick <= wheel->now) {
+                timer->prev = NULL;
+                wheel->count--;
+                timer->fire(timer);
+            } else {
+                place(wheel, timer);
+            }
+            timer = next;
+        }
+    }
+    if (target > wheel->now) {
+        wheel->now = target;
+    }
+}
+
+uint64_t tpool_timer_wheel_next(const tpool_timer_wheel *wheel) {
+    unsigned level = 0, slot = 0;
+    uint64_t tick = 0;
+    if (!next_slot(wheel, &level, &slot, &tick)) {
+        return UINT64_MAX;
+    }
+    return tick << TPOOL_TIMER_TICK_SHIFT;
+}
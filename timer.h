@@ -0,0 +1,81 @@
+#ifndef TPOOL_TIMER_H
+#define TPOOL_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TPOOL_TIMER_LEVELS 11
+#define TPOOL_TIMER_SLOTS 64
+// ticks of 1024 ns
+#define TPOOL_TIMER_TICK_SHIFT 10
+
+typedef struct tpool_timer tpool_timer;
+
+/**
+ * A timer, usually embedded in whatever it wakes. Only the deadline and fire
+ * are set by the owner; the rest belongs to the wheel.
+ */
+struct tpool_timer {
+    // CLOCK_MONOTONIC nanoseconds
+    uint64_t deadline;
+    // called once the deadline has passed, after the timer left the wheel
+    void (*fire)(tpool_timer *timer);
+    uint64_t tick;
+    unsigned level;
+    unsigned slot;
+    tpool_timer *next;
+    // NULL while not in a wheel
+    tpool_timer **prev;
+};
+
+/**
+ * Hierarchical timer wheel. Each level has 64 slots, each spanning 64 slots
+ * of the level below, and a timer sits in the lowest level that can tell its
+ * tick apart from the current one. Timers move down a level whenever the
+ * wheel reaches their slot, so adding and removing are O(1) and advancing is
+ * proportional to the number of occupied slots passed.
+ *
+ * Not thread safe.
+ */
+typedef struct tpool_timer_wheel {
+    // in ticks; every timer up to now has fired
+    uint64_t now;
+    size_t count;
+    uint64_t occupied[TPOOL_TIMER_LEVELS];
+    tpool_timer *slots[TPOOL_TIMER_LEVELS][TPOOL_TIMER_SLOTS];
+} tpool_timer_wheel;
+
+/**
+ * Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t tpool_timer_now(void);
+
+void tpool_timer_wheel_init(tpool_timer_wheel *wheel, uint64_t now);
+
+/**
+ * Adds timer to the wheel. Returns false without adding it if its deadline
+ * has already been passed by the wheel.
+ */
+bool tpool_timer_add(tpool_timer_wheel *wheel, tpool_timer *timer);
+
+/**
+ * Removes timer from the wheel if it has not fired yet.
+ */
+void tpool_timer_remove(tpool_timer_wheel *wheel, tpool_timer *timer);
+
+static inline bool tpool_timer_pending(const tpool_timer *timer) {
+    return timer->prev != NULL;
+}
+
+/**
+ * Fires every timer with a deadline up to now.
+ */
+void tpool_timer_wheel_advance(tpool_timer_wheel *wheel, uint64_t now);
+
+/**
+ * Returns when the wheel next needs advancing, which is no later than the
+ * earliest deadline in it, or UINT64_MAX if it is empty.
+ */
+uint64_t tpool_timer_wheel_next(const tpool_timer_wheel *wheel);
+
+#endif
@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "topology.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/mempolicy.h>
+
+#define TPOOL_NODE_PATH "/sys/devices/system/node"
+
+/*
+ * Marks the CPUs of a list such as "0-3,8,10-11" as belonging to node.
+ */
+static void parse_cpulist(const char *list, int *cpu_node, int node) {
+    const char *p = list;
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p) {
+            return;
+        }
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p) {
+                return;
+            }
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            if (cpu >= 0) {
+                cpu_node[cpu] = node;
+            }
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+}
+
+static void read_nodes(int *cpu_node) {
+    DIR *dir = opendir(TPOOL_NODE_PATH);
+    if (dir == NULL) {
+        return;
+    }
+    for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+        int node;
+        if (sscanf(entry->d_name, "node%d", &node) != 1) {
+            continue;
+        }
+        char path[sizeof(TPOOL_NODE_PATH) + 64];
+        snprintf(path, sizeof(path), TPOOL_NODE_PATH "/node%d/cpulist", node);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) {
+            continue;
+        }
+        char list[4096];
+        if (fgets(list, sizeof(list), file) != NULL) {
+            parse_cpulist(list, cpu_node, node);
+        }
+        fclose(file);
+    }
+    closedir(dir);
+}
+
+bool tpool_topology_init(tpool_topology *topology) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        CPU_ZERO(&allowed);
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long cpu = 0; cpu < (online > 0 ? online : 1) && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &allowed);
+        }
+    }
+    size_t count = CPU_COUNT(&allowed);
+
+    int *cpu_node = malloc(CPU_SETSIZE * sizeof(int));
+    topology->cpus = malloc(count * sizeof(int));
+    topology->nodes = malloc(count * sizeof(int));
+    if (cpu_node == NULL || topology->cpus == NULL || topology->nodes == NULL) {
+        free(cpu_node);
+        tpool_topology_free(topology);
+        return false;
+    }
+    // CPUs missing from sysfs are put on node 0
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        cpu_node[cpu] = 0;
+    }
+    read_nodes(cpu_node);
+
+    int max_node = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && cpu_node[cpu] > max_node) {
+            max_node = cpu_node[cpu];
+        }
+    }
+    topology->cpu_count = 0;
+    topology->node_count = 0;
+    for (int node = 0; node <= max_node; node++) {
+        size_t before = topology->cpu_count;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed) && cpu_node[cpu] == node) {
+                topology->cpus[topology->cpu_count] = cpu;
+                topology->nodes[topology->cpu_count] = node;
+                topology->cpu_count++;
+            }
+        }
+        if (topology->cpu_count > before) {
+            topology->node_count++;
+        }
+    }
+    free(cpu_node);
+    return true;
+}
+
+bool tpool_topology_pin(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool tpool_topology_confine(const int *cpus, size_t count) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < count; i++) {
+        if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE) {
+            CPU_SET(cpus[i], &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool tpool_topology_nice(int nice) {
+    // Linux keeps the niceness per thread, which the thread ID selects
+    return setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), nice) == 0;
+}
+
+void tpool_topology_bind(void *addr, size_t size, int node) {
+    if (node < 0 || node >= (int) (sizeof(unsigned long) * 8)) {
+        return;
+    }
+    unsigned long mask = 1ul << node;
+    // only a preference, so a full node still falls back to the others
+    syscall(SYS_mbind, addr, size, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+}
+
+#else
+
+bool tpool_topology_init(tpool_topology *topology) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t count = online > 0 ? (size_t) online : 1;
+    topology->cpus = malloc(count * sizeof(int));
+    topology->nodes = malloc(count * sizeof(int));
+    if (topology->cpus == NULL || topology->nodes == NULL) {
+        tpool_topology_free(topology);
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        topology->cpus[i] = (int) i;
+        topology->nodes[i] = 0;
+    }
+    topology->cpu_count = count;
+    topology->node_count = 1;
+    return true;
+}
+
+bool tpool_topology_pin(int cpu) {
+    (void) cpu;
+    return false;
+}
+
+bool tpool_topology_confine(const int *cpus, size_t count) {
+    (void) cpus;
+    (void) count;
+    return false;
+}
+
+bool tpool_topology_nice(int nice) {
+    (void) nice;
+    return false;
+}
+
+void tpool_topology_bind(void *addr, size_t size, int node) {
+    (void) addr;
+    (void) size;
+    (void) node;
+}
+
+#endif
+
+bool tpool_topology_restrict(tpool_topology *topology, const int *cpus, size_t count) {
+    size_t kept = 0;
+    size_t nodes = 0;
+    for (size_t i = 0; i < topology->cpu_count; i++) {
+        bool listed = false;
+        for (size_t j = 0; j < count && !listed; j++) {
+            listed = cpus[j] == topology->cpus[i];
+        }
+        if (!listed) {
+            continue;
+        }
+        // CPUs are grouped by node, so a new node starts where it changes
+        if (kept == 0 || topology->nodes[kept - 1] != topology->nodes[i]) {
+            nodes++;
+        }
+        topology->cpus[kept] = topology->cpus[i];
+        topology->nodes[kept] = topology->nodes[i];
+        kept++;
+    }
+    topology->cpu_count = kept;
+    topology->node_count = nodes;
+    return kept > 0;
+}
+
+void tpool_topology_free(tpool_topology *topology) {
+    free(topology->cpus);
+    free(topology->nodes);
+    topology->cpus = NULL;
+    topology->nodes = NULL;
+}
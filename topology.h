@@ -0,0 +1,55 @@
+#ifndef TPOOL_TOPOLOGY_H
+#define TPOOL_TOPOLOGY_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+/**
+ * The CPUs the process may run on and the NUMA node of each, as read from
+ * the affinity mask and /sys/devices/system/node. Machines without NUMA
+ * information are treated as a single node.
+ */
+typedef struct tpool_topology {
+    // ordered by node, then by number, so that consecutive CPUs share a node
+    int *cpus;
+    int *nodes;
+    size_t cpu_count;
+    size_t node_count;
+} tpool_topology;
+
+/**
+ * Returns false if the tables cannot be allocated.
+ */
+bool tpool_topology_init(tpool_topology *topology);
+
+void tpool_topology_free(tpool_topology *topology);
+
+/**
+ * Drops the CPUs that are not among the count in cpus, keeping the order of
+ * the rest. Returns false if none are left.
+ */
+bool tpool_topology_restrict(tpool_topology *topology, const int *cpus, size_t count);
+
+/**
+ * Pins the calling thread to cpu. Returns false on failure.
+ */
+bool tpool_topology_pin(int cpu);
+
+/**
+ * Lets the calling thread run on any of the count CPUs in cpus. Returns
+ * false on failure.
+ */
+bool tpool_topology_confine(const int *cpus, size_t count);
+
+/**
+ * Sets the niceness of the calling thread alone. Returns false on failure.
+ */
+bool tpool_topology_nice(int nice);
+
+/**
+ * Asks for the pages of [addr, addr + size), which must be page aligned, to
+ * be placed on node when first touched. Does nothing if node is negative.
+ */
+void tpool_topology_bind(void *addr, size_t size, int node);
+
+#endif
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include "trace.h"
+
+tpool_trace *tpool_trace_init(size_t capacity) {
+    tpool_trace *trace = malloc(sizeof(tpool_trace) + capacity * sizeof(tpool_trace_event));
+    if (trace == NULL) {
+        return NULL;
+    }
+    atomic_init(&trace->head, 0);
+    trace->capacity = capacity;
+    return trace;
+}
+
+void tpool_trace_free(tpool_trace *trace) {
+    free(trace);
+}
+
+tpool_trace_epoch tpool_trace_epoch_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (tpool_trace_epoch) {
+        .clock = tpool_trace_clock(),
+        .ns = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec,
+    };
+}
+
+static const char *event_phase(uint32_t type) {
+    switch (type) {
+        case TPOOL_TRACE_SPAWN:
+            return "i";
+        case TPOOL_TRACE_START:
+        case TPOOL_TRACE_RESUME:
+        case TPOOL_TRACE_PARK:
+            return "B";
+        default:
+            return "E";
+    }
+}
+
+static const char *event_name(uint32_t type) {
+    switch (type) {
+        case TPOOL_TRACE_SPAWN:
+            return "spawn";
+        case TPOOL_TRACE_PARK:
+        case TPOOL_TRACE_UNPARK:
+            return "idle";
+        default:
+            return "task";
+    }
+}
+
+// why a task slice began or ended
+static const char *event_reason(uint32_t type) {
+    switch (type) {
+        case TPOOL_TRACE_START:
+            return "start";
+        case TPOOL_TRACE_RESUME:
+            return "resume";
+        case TPOOL_TRACE_SUSPEND:
+            return "suspend";
+        case TPOOL_TRACE_YIELD:
+            return "yield";
+        case TPOOL_TRACE_COMPLETE:
+            return "complete";
+        default:
+            return NULL;
+    }
+}
+
+int tpool_trace_write(FILE *file, tpool_trace **traces, size_t count, tpool_trace_epoch start) {
+    tpool_trace_epoch end = tpool_trace_epoch_now();
+    double ns_per_tick = end.clock > start.clock
+        ? (double) (end.ns - start.ns) / (double) (end.clock - start.clock) : 1.0;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"tpool\"}}");
+    for (size_t i = 0; i < count; i++) {
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,"
+            "\"args\":{\"name\":\"worker %zu\"}}", i, i);
+        tpool_trace *trace = traces[i];
+        if (trace == NULL) {
+            continue;
+        }
+        uint64_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+        uint64_t first = head > trace->capacity ? head - trace->capacity : 0;
+        for (uint64_t j = first; j < head; j++) {
+            tpool_trace_event *event = &trace->events[j % trace->capacity];
+            // the TSCs of different CPUs can be slightly apart
+            if (event->time < start.clock) {
+                continue;
+            }
+            double us = (double) (event->time - start.clock) * ns_per_tick / 1000.0;
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%zu",
+                event_name(event->type), event_phase(event->type), us, i);
+            if (event->type == TPOOL_TRACE_SPAWN) {
+                fprintf(file, ",\"s\":\"t\"");
+            }
+            const char *reason = event_reason(event->type);
+            if (event->task != 0 && reason != NULL) {
+                fprintf(file, ",\"args\":{\"task\":\"%#lx\",\"%s\":\"%s\"}",
+                    (unsigned long) event->task, event->type <= TPOOL_TRACE_RESUME ? "begin" : "end", reason);
+            } else if (event->task != 0) {
+                fprintf(file, ",\"args\":{\"task\":\"%#lx\"}", (unsigned long) event->task);
+            }
+            fprintf(file, "}");
+        }
+    }
+    fprintf(file, "\n]}\n");
+    if (ferror(file)) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
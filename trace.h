@@ -0,0 +1,99 @@
+#ifndef TPOOL_TRACE_H
+#define TPOOL_TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+typedef enum tpool_trace_type {
+    TPOOL_TRACE_SPAWN,
+    // a task starts or continues running
+    TPOOL_TRACE_START,
+    TPOOL_TRACE_RESUME,
+    // a task stops running
+    TPOOL_TRACE_SUSPEND,
+    TPOOL_TRACE_YIELD,
+    TPOOL_TRACE_COMPLETE,
+    // the worker goes to sleep and wakes up
+    TPOOL_TRACE_PARK,
+    TPOOL_TRACE_UNPARK,
+} tpool_trace_type;
+
+typedef struct tpool_trace_event {
+    // tpool_trace_clock ticks
+    uint64_t time;
+    // address of the task, 0 for worker events
+    uintptr_t task;
+    uint32_t type;
+} tpool_trace_event;
+
+/**
+ * Ring of the latest events of one worker, which overwrites the oldest once
+ * full. Only the worker writes to it, so recording an event takes no atomic
+ * read-modify-write.
+ */
+typedef struct tpool_trace {
+    _Atomic uint64_t head;
+    size_t capacity;
+    tpool_trace_event events[];
+} tpool_trace;
+
+/**
+ * Returns NULL if the ring cannot be allocated.
+ */
+tpool_trace *tpool_trace_init(size_t capacity);
+
+void tpool_trace_free(tpool_trace *trace);
+
+/**
+ * Cheap timestamp: the TSC where there is one, CLOCK_MONOTONIC nanoseconds
+ * elsewhere.
+ */
+static inline uint64_t tpool_trace_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline void tpool_trace_record(tpool_trace *trace, tpool_trace_type type, const void *task) {
+    uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    trace->events[head % trace->capacity] = (tpool_trace_event) {
+        .time = tpool_trace_clock(),
+        .task = (uintptr_t) task,
+        .type = type,
+    };
+    atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+/**
+ * A tpool_trace_clock reading together with the time it was taken at, to
+ * convert timestamps to nanoseconds.
+ */
+typedef struct tpool_trace_epoch {
+    uint64_t clock;
+    uint64_t ns;
+} tpool_trace_epoch;
+
+tpool_trace_epoch tpool_trace_epoch_now(void);
+
+/**
+ * Writes the events of count traces as Chrome trace-event JSON, one thread
+ * per trace, with times relative to start. Tasks running are shown as
+ * slices, sleeping workers as "idle" slices, and spawns as instant events.
+ *
+ * Events recorded while this runs may be torn, so the workers should be
+ * quiet. Returns 0, or -1 with errno set if writing fails.
+ */
+int tpool_trace_write(FILE *file, tpool_trace **traces, size_t count, tpool_trace_epoch start);
+
+#endif